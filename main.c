@@ -1,8 +1,20 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 #include <glad/glad.h>
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <linmath.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
 
 #define ERROR_EXIT(E, ...)     SDL_Log(__VA_ARGS__); exit(E)
 #define ERROR_RETURN(R, ...)   SDL_Log(__VA_ARGS__); return R
@@ -13,8 +25,73 @@
 #define R_HEIGHT               720.0f
 #define DRAG                   0.035
 #define CAPACITY               128
+#define BULLET_CAP             4096
+#define BULLET_LIFE            1300
+#define BULLET_SPEED           (PLAYER_SPEED * 28.0f)
+#define PARTICLE_CAP           (1 << 17)
+#define MAX_EMITTERS           1024
+#define PARTICLE_DIRS          256
 #define PI                     3.14159265359f
 #define TAU                    2.0f * PI
+#define SHAPE_STRIDE           14
+#define STREAM_FRAMES          3
+#define STREAM_REGION          (1 << 20)
+#define SIM_HZ                 60
+#define SIM_MIN_HZ             30
+#define SIM_MAX_HZ             240
+#define SIM_MAX_LAG            0.25
+/* Every parallel array is allocated on this boundary so flat loops vectorize. */
+#define AST_ALIGN              64
+#define AST_BLOCK              64
+#define AST_CHUNK              1024
+#define AST_SLOT_BITS          23
+#define AST_SLOT_MASK          ((1u << AST_SLOT_BITS) - 1)
+#define AST_NONE               0u
+#define BENCH_PROBES           8
+#define MICRO_SAMPLES          15
+#define MICRO_SAMPLE_NS        2000000.0
+#define MICRO_REGRESSION       10.0
+#define MICRO_SEED             0x5eedull
+#define GRID_CELL              81.0f
+#define JOB_DEQUE              2048
+#define JOB_GRAIN              4096
+#define JOB_MAX_CHUNKS         1024
+#define JOB_MAX_THREADS        64
+#define REC_MAGIC              "ASTR"
+#define REC_VERSION            1
+#define REC_BUILD_LEN          32
+#define REC_MAX_FIRE           31
+#ifndef BUILD_ID
+#define BUILD_ID               __DATE__ " " __TIME__
+#endif
+
+/* Keeps the scalar reference kernel scalar under -O2 auto-vectorisation. */
+#if defined(__GNUC__) && !defined(__clang__)
+#define NO_VECTORIZE           __attribute__((optimize("no-tree-vectorize")))
+#else
+#define NO_VECTORIZE
+#endif
+#define PROF_FRAMES            600
+#define PROF_LAG               4
+#define PRESENT_FPS            120
+#define PRESENT_SPIN_NS        500000
+#define PROF_GRAPH             240
+
+typedef enum {
+    P_FRAME = 0,
+    P_EVENTS,
+    P_SIM,
+    P_PLAYER,
+    P_ASTEROIDS,
+    P_BULLETS,
+    P_COLLISION,
+    P_PARTICLES,
+    P_CHECKSUM,
+    P_RENDER,
+    P_SWAP,
+    P_GPU,
+    P_COUNT
+} PROF_SCOPE;
 
 typedef enum {
     BIG = 0,
@@ -23,20 +100,93 @@ typedef enum {
     DEAD
 } ASTEROID_SIZE;
 
+typedef enum {
+    U_PROJECTION = 0,
+    U_SHAPES,
+    U_STRIDE,
+    U_WORLD,
+    U_COPIES,
+    U_NOW,
+    U_DT,
+    U_ALPHA,
+    U_COUNT
+} UNIFORM;
+
+typedef enum {
+    A_POS = 0,
+    A_POS_SIZE,
+    A_ANGLE,
+    A_SHAPE,
+    A_VEL,
+    A_EXPIRE,
+    A_COUNT
+} ATTRIB;
+
+typedef enum {
+    PIPE_LINES = 0,
+    PIPE_POINTS,
+    PIPE_OUTLINES,
+    PIPE_PARTICLE_STEP,
+    PIPE_PARTICLES,
+    PIPE_COUNT
+} PIPELINE;
+
 typedef struct {
     float x, y;
 } Vector2;
 
+/* The per-asteroid struct the game used before Asteroids; kept as the
+ * baseline layout for bench_asteroids(). */
 typedef struct {
     Vector2 pos;
     Vector2 size;
     int seed;
+    int shape;
     Uint32 time;
     float angle;
     float vel;
     ASTEROID_SIZE as;
 } Asteroid;
 
+/* Live asteroids stay packed and move on removal, so holders keep an
+ * AstHandle: a slot in the low AST_SLOT_BITS, its generation above. */
+typedef Uint32 AstHandle;
+
+typedef struct {
+    float *x, *y;
+    float *dx, *dy;
+    float *radius;
+    Uint8 *class;
+    Uint32 *time;
+    float *px, *py;
+    float *w, *h;
+    float *angle;
+    float *cs, *sn;
+    int *seed;
+    int *shape;
+    AstHandle *id;
+    Uint32 *gen;
+    int *dense;
+    int *free;
+    int nr_free;
+    int size;
+    int cap;
+} Asteroids;
+
+/* Uniform grid over the torus. Cells are at least GRID_CELL, the largest
+ * outline radius, so a point's hit is in its cell or one of the 8 around it. */
+typedef struct {
+    int cols, rows;
+    float cell_w, cell_h;
+    int *start;
+    int *items;
+    int *cell;
+    int *hist;
+    int hist_cap;
+    int size;
+    int cap;
+} Grid;
+
 typedef struct {
     Vector2 pos;
     Vector2 size;
@@ -46,25 +196,506 @@ typedef struct {
     Uint8 life;
 } Player;
 
+/* Each part of the sim that draws random numbers owns a stream, so adding
+ * a draw in one cannot shift the values another sees. */
+typedef enum {
+    RNG_SPAWN = 0,
+    RNG_SPLIT,
+    RNG_SPARKS,
+    RNG_COUNT
+} RNG_STREAM;
+
+/* vsync and adaptive (late frames tear instead of waiting a whole
+ * refresh) go through the swap interval; capped turns it off and paces
+ * frames with present_limit. */
+typedef enum {
+    PRESENT_VSYNC = 0,
+    PRESENT_ADAPTIVE,
+    PRESENT_IMMEDIATE,
+    PRESENT_CAPPED,
+    PRESENT_COUNT
+} PRESENT_MODE;
+
+typedef enum {
+    BULLET_DROP_NEW = 0,
+    BULLET_DROP_OLDEST
+} BULLET_POLICY;
+
+/* Bullets all live BULLET_LIFE ms, so [head, head + size) is already
+ * sorted by expiry and expired ones leave as a prefix. */
+typedef struct {
+    float *x, *y;
+    float *px, *py;
+    float *dx, *dy;
+    Uint32 *expire;
+    int *hit;
+    int head;
+    int size;
+    int cap;
+    BULLET_POLICY policy;
+    Uint64 fired, hits, expired, dropped;
+} Bullets;
+
+/* rate particles per tick until the sim time passes until; a follow
+ * handle makes it ride along with that asteroid. */
+typedef struct {
+    float x, y;
+    float dx, dy;
+    float speed;
+    int rate;
+    Uint32 until;
+    Uint32 life;
+    AstHandle follow;
+} Emitter;
+
+/* A new particle as the GPU backend stores it; the layout is the vertex
+ * format of its buffers. */
 typedef struct {
-    Vector2 pos[CAPACITY];
-    Vector2 dir[CAPACITY];
-    Uint32 time[CAPACITY];
+    float x, y;
+    float dx, dy;
+    Uint32 expire;
+} Spawn;
+
+/* Directions come from a table; sinf and cosf per spawn cost more than
+ * the rest of the tick. When deferred, spawns queue for the GPU instead. */
+typedef struct {
+    float *x, *y;
+    float *px, *py;
+    float *dx, *dy;
+    Uint32 *expire;
     int size;
-} Bullet;
+    int cap;
+    Emitter emitter[MAX_EMITTERS];
+    int nr_emitters;
+    float dir_x[PARTICLE_DIRS];
+    float dir_y[PARTICLE_DIRS];
+    bool deferred;
+    Spawn *queue;
+    int nr_queue, cap_queue;
+    int *tick_end;
+    int nr_ticks, cap_ticks;
+    Uint64 spawned;
+    Uint64 dropped;
+} Particles;
+
+/* One buffer in STREAM_FRAMES regions, each guarded by a fence; a failed
+ * map falls back to glBufferSubData. */
+typedef struct {
+    unsigned int vbo;
+    unsigned int region_size;
+    unsigned int region;
+    unsigned int offset;
+    GLsync fence[STREAM_FRAMES];
+    Uint32 stalls;
+    Uint32 map_fails;
+    Uint32 bytes;
+    Uint32 last_bytes;
+    Uint64 frames;
+    Uint64 total_stalls;
+    Uint64 total_map_fails;
+    Uint64 total_bytes;
+} Stream;
+
+/* Shadow of the GL state we touch per frame. Binds that would not change
+ * anything are skipped; issued/elided count driver calls for the frame. */
+typedef struct {
+    unsigned int program;
+    unsigned int vao;
+    unsigned int array_buffer;
+    float point_size;
+    bool blend;
+    GLenum blend_src, blend_dst;
+    Uint32 issued, elided, draws, vertices;
+    Uint32 last_issued, last_elided, last_draws, last_vertices;
+    Uint64 frames, total_draws, total_vertices;
+} GLState;
+
+/* Uniform and attribute locations resolved once at link time, -1 when
+ * the program does not use them. */
+typedef struct {
+    const char *name;
+    const char *vs;
+    const char *fs;
+    const char *const *feedback;
+    int nr_feedback;
+    unsigned int program;
+    int uniform[U_COUNT];
+    int attrib[A_COUNT];
+} Shader;
+
+/* Frame-wide vertex stream for one primitive type, submitted in one draw. */
+typedef struct {
+    unsigned int vao;
+    Shader *sh;
+    GLenum mode;
+    float *vert;
+    int nr_v;
+    int cap_v;
+} Batch;
+
+/* Per-instance record; the vertex shader builds the transform from it. */
+typedef struct {
+    float x, y;
+    float w, h;
+    float angle;
+    int shape;
+} Instance;
 
+/* copies is 4 for world objects (self plus x, y and corner wrap ghosts)
+ * and 1 for screen-space ones like the HUD. */
 typedef struct {
     unsigned int vao;
+    Shader *sh;
+    int copies;
+    Instance *data;
+    int size;
+    int cap;
+} Instances;
+
+/* vbo[src] is a ring of cap Spawn records; each step writes the other
+ * buffer in the same slots. expire mirrors the ring so the oldest dead
+ * records can be trimmed off the live extent. */
+typedef struct {
+    Shader *step;
+    Shader *draw;
+    unsigned int vbo[2];
+    unsigned int vao[2];
+    Uint32 *expire;
+    int src;
+    int head;
+    int count;
+    int cap;
+    Uint64 steps;
+    Uint64 stepped;
+    Uint64 bytes;
+} GpuParticles;
+
+/* Slot i holds SHAPE_STRIDE vertices, padded with the closing vertex so
+ * every instance draws the same count; sx/sy split them for collisions. */
+typedef struct {
+    float *vert;
+    float *sx, *sy;
+    int *free;
+    int nr_free;
+    int cap;
     unsigned int vbo;
-    unsigned int size;
-} Renderer;
+    unsigned int tex;
+} ShapeCache;
+
+/* One row of inclusive ms per frame, -1 where unmeasured. P_GPU lands
+ * up to PROF_LAG frames late so reading queries never stalls. */
+typedef struct {
+    Uint64 freq;
+    Uint64 start[P_COUNT];
+    int depth[P_COUNT];
+    int top;
+    Uint64 frame;
+    float ms[PROF_FRAMES][P_COUNT];
+    unsigned int query[PROF_LAG];
+    Uint64 query_frame[PROF_LAG];
+    bool pending[PROF_LAG];
+    bool timing;
+} Profiler;
+
+/* Frame pacing, plus frame time and CPU use since the mode was set.
+ * Times are SDL_GetTicksNS; mean and m2 are Welford sums in ms. */
+typedef struct {
+    PRESENT_MODE mode;
+    bool finish;
+    int fps;
+    Uint64 next;
+    Uint64 last;
+    Uint64 frames;
+    double mean, m2;
+    float worst;
+    Uint64 wall_start, cpu_start;
+} Present;
+
+typedef void (*JobFn)(void *data, int begin, int end);
+
+/* fn always sees the same grain-sized chunks however the range was
+ * split; left counts the owning parallel_for's outstanding jobs. */
+typedef struct {
+    JobFn fn;
+    void *data;
+    int begin, end;
+    int grain;
+    SDL_AtomicInt *left;
+} Job;
+
+/* Chase-Lev deque: the owner works the bottom, thieves CAS the top. A full
+ * deque just stops its owner from splitting further. */
+typedef struct {
+    SDL_AtomicU32 top;
+    Uint8 pad[60];
+    SDL_AtomicU32 bottom;
+    void *slot[JOB_DEQUE];
+    Job ring[JOB_DEQUE];
+    int next;
+} JobDeque;
+
+/* Thread 0 is the caller of parallel_for(); the others are workers that
+ * steal from everyone and sleep on wake when there is nothing to take. */
+typedef struct {
+    int threads;
+    SDL_Thread *thread[JOB_MAX_THREADS];
+    JobDeque *deque;
+    SDL_Semaphore *wake;
+    SDL_AtomicInt sleeping;
+    SDL_AtomicInt quit;
+} Jobs;
+
+/* Controls as sampled for one tick. fire counts presses not yet consumed,
+ * so a press survives frames that run no tick; a tick takes at most
+ * REC_MAX_FIRE of them so it fits the recording format. */
+typedef struct {
+    bool thrust;
+    bool left;
+    bool right;
+    int fire;
+} Input;
+
+/* --stress load test: asteroids drawn by mix, auto-fire, and every live
+ * asteroid hit on tick cascade (0 for never). */
+typedef struct {
+    bool on;
+    int asteroids;
+    int mix[3];
+    int bullets;
+    Uint64 cascade;
+} Stress;
+
+/* Everything the fixed-rate sim owns. time comes from the tick count and
+ * all randomness from rng, so seed and inputs fix the whole run. */
+typedef struct {
+    Player p;
+    Vector2 prev_pos;
+    float prev_angle;
+    Asteroids ast;
+    Grid grid;
+    Bullets b;
+    Particles fx;
+    bool dead;
+    Uint32 dtime;
+    float angle;
+    bool thrust;
+    int hz;
+    float dt;
+    Uint64 ticks;
+    Uint32 time;
+    Uint64 seed;
+    Uint64 rng[RNG_COUNT];
+    Uint64 checksum;
+    Stress stress;
+    float fire_angle;
+} Game;
+
+/* --record/--replay log: a header, then runs of identical ticks as one
+ * packed input byte and a LEB128 run length. */
+typedef struct {
+    SDL_IOStream *io;
+    const char *path;
+    bool writing;
+    Uint16 hz;
+    Uint64 seed;
+    char build[REC_BUILD_LEN];
+    Uint64 ticks;
+    Uint64 checksum;
+    Uint8 state;
+    Uint64 run;
+} InputLog;
+
+typedef void (*IntegrateWrap)(float *x, float *y, const float *dx, const float *dy,
+        const Uint32 *time, Uint32 now, float dt, int n);
+
+/* One ISA variant of a kernel; supported is NULL when it always runs. */
+typedef struct {
+    const char *name;
+    IntegrateWrap fn;
+    bool (*supported)(void);
+} Kernel;
+
+/* Command line. frames == 0 runs until quit or game over. uncapped runs
+ * one tick per frame without vsync, as headless always does. Headless
+ * simulates particles on the CPU unless --particles gpu is given. */
+typedef struct {
+    bool headless;
+    bool uncapped;
+    const char *record;
+    const char *replay;
+    Uint64 frames;
+    const char *profile;
+    int hz;
+    bool bench;
+    bool seeded;
+    Uint64 seed;
+    int threads;
+    bool gpu_particles;
+    bool particles_set;
+    Stress stress;
+    const char *microbench;
+    const char *baseline;
+    double threshold;
+    PRESENT_MODE present;
+    bool present_set;
+    int fps;
+    bool finish;
+} Options;
+
+static const char *uniform_names[U_COUNT] = {
+    "projection", "shapes", "stride", "world", "copies", "now", "dt", "alpha"
+};
+
+static const char *attrib_names[A_COUNT] = {
+    "aPos", "aPosSize", "aAngle", "aShape", "aVel", "aExpire"
+};
+
+static const char *present_names[PRESENT_COUNT] = {
+    "vsync", "adaptive", "immediate", "capped"
+};
+
+static const char *prof_names[P_COUNT] = {
+    "frame", "events", "sim", "player", "asteroids", "bullets",
+    "collision", "particles", "checksum", "render", "swap", "gpu"
+};
+
+static const char flat_vs[] = 
+    "#version 330 core\n"
+    "layout (location = 0) in vec3 aPos;\n"
+    "uniform mat4 projection;\n"
+    "void main()\n"
+    "{\n"
+    "   gl_Position = projection * vec4(aPos.xyz, 1.0);\n"
+    "}\0";
+
+/* Copy k of an instance shifts by a world width (bit 0) and height
+ * (bit 1) towards the far side; copies not needed go off clip space. */
+static const char outline_vs[] = 
+    "#version 330 core\n"
+    "layout (location = 0) in vec4 aPosSize;\n"
+    "layout (location = 1) in float aAngle;\n"
+    "layout (location = 2) in int aShape;\n"
+    "uniform mat4 projection;\n"
+    "uniform samplerBuffer shapes;\n"
+    "uniform int stride;\n"
+    "uniform vec2 world;\n"
+    "uniform int copies;\n"
+    "void main()\n"
+    "{\n"
+    "   int k = gl_InstanceID % copies;\n"
+    "   vec2 pick = vec2(k & 1, k >> 1);\n"
+    "   vec2 pos = aPosSize.xy;\n"
+    "   float r = max(aPosSize.z, aPosSize.w);\n"
+    "   vec2 edge = step(min(pos, world - pos), vec2(r));\n"
+    "   if (any(greaterThan(pick, edge))) {\n"
+    "       gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+    "       return;\n"
+    "   }\n"
+    "   pos += pick * sign(world * 0.5 - pos) * world;\n"
+    "   vec2 v = texelFetch(shapes, aShape * stride + gl_VertexID).xy * aPosSize.zw;\n"
+    "   float c = cos(aAngle);\n"
+    "   float s = sin(aAngle);\n"
+    "   vec2 p = pos + vec2(c * v.x - s * v.y, s * v.x + c * v.y);\n"
+    "   gl_Position = projection * vec4(p, 0.0, 1.0);\n"
+    "}\0";
+
+/* One fixed step of a GPU particle, wrapped the same way as
+ * integrate_wrap_scalar. */
+static const char particle_step_vs[] = 
+    "#version 330 core\n"
+    "layout (location = 0) in vec2 aPos;\n"
+    "layout (location = 1) in vec2 aVel;\n"
+    "layout (location = 2) in uint aExpire;\n"
+    "uniform vec2 world;\n"
+    "uniform float dt;\n"
+    "out vec2 outPos;\n"
+    "out vec2 outVel;\n"
+    "flat out uint outExpire;\n"
+    "void main()\n"
+    "{\n"
+    "   vec2 p = aPos + aVel * dt;\n"
+    "   outPos = p + world * vec2(lessThan(p, vec2(0.0)))\n"
+    "       - world * vec2(greaterThanEqual(p, world));\n"
+    "   outVel = aVel;\n"
+    "   outExpire = aExpire;\n"
+    "}\0";
+
+static const char *const particle_varyings[] = {"outPos", "outVel", "outExpire"};
+
+/* The previous position is one step back along the velocity; when that
+ * falls outside the world the particle wrapped and snaps instead, like
+ * vector2_lerp_wrap. Expired particles are moved off clip space. */
+static const char particle_vs[] = 
+    "#version 330 core\n"
+    "layout (location = 0) in vec2 aPos;\n"
+    "layout (location = 1) in vec2 aVel;\n"
+    "layout (location = 2) in uint aExpire;\n"
+    "uniform mat4 projection;\n"
+    "uniform vec2 world;\n"
+    "uniform uint now;\n"
+    "uniform float dt;\n"
+    "uniform float alpha;\n"
+    "void main()\n"
+    "{\n"
+    "   if (aExpire <= now) {\n"
+    "       gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+    "       return;\n"
+    "   }\n"
+    "   vec2 p = aPos - aVel * (dt * (1.0 - alpha));\n"
+    "   if (any(lessThan(p, vec2(0.0))) || any(greaterThanEqual(p, world))) p = aPos;\n"
+    "   gl_Position = projection * vec4(p, 0.0, 1.0);\n"
+    "}\0";
+
+static const char white_fs[] = 
+    "#version 330 core\n"
+    "out vec4 FragColor;\n"
+    //"uniform float t;\n"
+    "void main() { \n"
+    //"    vec3 color = 0.9 + 0.5 * (cos(t * vec3(0.5, 0.2, 0.3)));\n"
+    "    FragColor = vec4(1.0, 1.0, 1.0, 1.0f);\n"
+    "}\0"; 
+
+Shader pipelines[PIPE_COUNT] = {
+    [PIPE_LINES]    = { .name = "lines",    .vs = flat_vs,    .fs = white_fs },
+    [PIPE_POINTS]   = { .name = "points",   .vs = flat_vs,    .fs = white_fs },
+    [PIPE_OUTLINES] = { .name = "outlines", .vs = outline_vs, .fs = white_fs },
+    [PIPE_PARTICLE_STEP] = { .name = "particle_step", .vs = particle_step_vs,
+        .feedback = particle_varyings, .nr_feedback = SDL_arraysize(particle_varyings) },
+    [PIPE_PARTICLES] = { .name = "particles", .vs = particle_vs, .fs = white_fs },
+};
+
+/* Stroke font on a 4x6 grid: pairs of digits are points, a space lifts
+ * the pen. Covers what the debug overlays print. */
+static const char *glyphs[128] = {
+    ['0'] = "0040460600",   ['1'] = "102026 0646",    ['2'] = "004043030646",
+    ['3'] = "00404606 0343", ['4'] = "000343 4046",   ['5'] = "400003434606",
+    ['6'] = "400006464303", ['7'] = "004046",         ['8'] = "0040460600 0343",
+    ['9'] = "430300404606", ['A'] = "0602204246 0444", ['B'] = "003041423303 3344453606 0006",
+    ['C'] = "40000646",     ['D'] = "00304244360600", ['E'] = "40000646 0333",
+    ['F'] = "400006 0333",  ['G'] = "400006464323",   ['H'] = "0006 4046 0343",
+    ['I'] = "0040 2026 0646", ['J'] = "40460604",     ['K'] = "0006 400346",
+    ['L'] = "000646",       ['M'] = "0600234046",     ['N'] = "06004640",
+    ['O'] = "0040460600",   ['P'] = "0600404303",     ['Q'] = "0040460600 2446",
+    ['R'] = "0600404303 2346", ['S'] = "400003434606", ['T'] = "0040 2026",
+    ['U'] = "00064640",     ['V'] = "002640",         ['W'] = "0006234640",
+    ['X'] = "0046 4006",    ['Y'] = "002340 2326",    ['Z'] = "00400646",
+    [':'] = "2122 2425",    ['.'] = "2526",           ['-'] = "0343",
+    ['/'] = "4006",         ['%'] = "4006 0001 4546", ['_'] = "0646",
+};
 
 mat4x4 projection;
-unsigned int shader;
+/* No window or GL context: flushes only count what they would submit. */
+bool headless;
+GLState gl;
+ShapeCache shapes;
+Stream stream;
+Profiler prof;
+Jobs jobs;
+Batch lines;
 SDL_GLContext con;
 
 SDL_Window 
-*init_window(int width, int height)
+*init_window(int width, int height, SDL_WindowFlags flags)
 {
     if (!SDL_Init(SDL_INIT_VIDEO)) {
         SDL_Log("SDL initialization failed: %s\n", SDL_GetError());
@@ -75,7 +706,7 @@ SDL_Window
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 
     SDL_Window* window = 
-        SDL_CreateWindow("Asteroid", width, height, SDL_WINDOW_OPENGL);
+        SDL_CreateWindow("Asteroid", width, height, SDL_WINDOW_OPENGL | flags);
 
     if (!window) {
         ERROR_EXIT(-1, "Window creation failed: %s\n", SDL_GetError());
@@ -94,368 +725,3860 @@ SDL_Window
     return window;
 }
 
-Renderer
-renderer_init(unsigned int size)
+void
+gl_use_program(unsigned int program)
 {
-    Renderer r;
-    r.size = size;
-
-    glGenVertexArrays(1, &r.vao);
-    glGenBuffers(1, &r.vbo);
-    
-    glBindVertexArray(r.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, r.vbo);
-    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    return r;
+    if (gl.program == program) { gl.elided++; return; }
+    glUseProgram(program);
+    gl.program = program;
+    gl.issued++;
 }
 
 void
-update_renderer(Renderer *renderer, float *vert, unsigned int size)
+gl_bind_vao(unsigned int vao)
 {
-    if (size > renderer->size) {
-        glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo);
-        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
-        renderer->size = size;
-    }
-    
-    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, size, vert);
+    if (gl.vao == vao) { gl.elided++; return; }
+    glBindVertexArray(vao);
+    gl.vao = vao;
+    gl.issued++;
 }
 
-Vector2
-vector2_scale(Vector2 *vec, const float s)
+void
+gl_bind_array_buffer(unsigned int vbo)
 {
-    Vector2 r;
-    r.x = vec->x * s;
-    r.y = vec->y * s;
-    return r;
+    if (gl.array_buffer == vbo) { gl.elided++; return; }
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    gl.array_buffer = vbo;
+    gl.issued++;
 }
 
-Vector2 
-vector2_add(Vector2 a, Vector2 b)
+void
+gl_point_size(float size)
 {
-    Vector2 r;
-    r.x = a.x + b.x;
-    r.y = a.y + b.y;
-    return r;
+    if (gl.point_size == size) { gl.elided++; return; }
+    glPointSize(size);
+    gl.point_size = size;
+    gl.issued++;
 }
 
-Vector2
-vector2_modf(Vector2 a, const float d1, const float d2)
+void
+gl_blend(bool on, GLenum src, GLenum dst)
 {
-    Vector2 v;
-    v.x =  SDL_fmodf(SDL_fmodf(a.x, d1) + d1, d1);
-    v.y =  SDL_fmodf(SDL_fmodf(a.y, d2) + d2, d2);
-    return v;
-}
-
-void 
-draw(GLenum mode, Vector2 *pos, Vector2 *size,
-        float angle, unsigned int vao, int nr_v) 
-{
-    mat4x4 trans;
-    mat4x4_identity(trans);
-    mat4x4 ret;
-    mat4x4_translate(trans, pos->x, pos->y, 0.0f);
-    mat4x4_rotate(ret, trans, 0.0f, 0.0f, 1.0f, angle);
-    mat4x4_scale_aniso(trans, ret, size->x, size->y, 0.0);
-
-    mat4x4_mul(ret, projection, trans);
-    glUseProgram(shader);
-    glUniformMatrix4fv(glGetUniformLocation(shader, "transform"),
-            1, GL_FALSE, (GLfloat *)ret);
-    glBindVertexArray(vao);
-    glDrawArrays(mode, 0, nr_v);
+    if (gl.blend == on && (!on || (gl.blend_src == src && gl.blend_dst == dst))) {
+        gl.elided++;
+        return;
+    }
+    if (on) {
+        glEnable(GL_BLEND);
+        glBlendFunc(src, dst);
+    } else {
+        glDisable(GL_BLEND);
+    }
+    gl.blend = on;
+    gl.blend_src = src;
+    gl.blend_dst = dst;
+    gl.issued++;
 }
 
-Vector2 
-get_direction(float angle) 
+/* For calls that always reach the driver (draws, uploads, uniforms). */
+void
+gl_count(Uint32 calls)
 {
-    Vector2 dir;
-    dir.x = SDL_cosf(angle + (PI * 0.5f));
-    dir.y = SDL_sinf(angle + (PI * 0.5f));
-    return dir;
+    gl.issued += calls;
 }
 
-void 
-vao_init(unsigned int *vao, unsigned int *vbo, float *vert, size_t vert_size)
+void
+gl_begin_frame(void)
 {
-    glGenVertexArrays(1, vao);
-    glGenBuffers(1, vbo);
-    glBindVertexArray(*vao);
-    glBindBuffer(GL_ARRAY_BUFFER, *vbo);
-    glBufferData(GL_ARRAY_BUFFER, vert_size, vert, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    gl.last_issued = gl.issued;
+    gl.last_elided = gl.elided;
+    gl.last_draws = gl.draws;
+    gl.last_vertices = gl.vertices;
+    gl.total_draws += gl.draws;
+    gl.total_vertices += gl.vertices;
+    gl.frames++;
+    gl.issued = 0;
+    gl.elided = 0;
+    gl.draws = 0;
+    gl.vertices = 0;
 }
 
-void 
-check_shader_err(unsigned int shader, GLenum pname, char *err_str) 
+void
+stream_init(Stream *s, unsigned int region_size)
 {
-    int  success;
-    char infoLog[512];
-    if(pname == GL_LINK_STATUS) {
-        glGetProgramiv(shader, pname, &success);
-    } else {
-        glGetShaderiv(shader, pname, &success);
-    }
-    
-    if(!success) {
-        glGetShaderInfoLog(shader, 512, NULL, infoLog);
-        SDL_Log("ERROR SHADER %s COMPILATION_FAILED %s\n", err_str, infoLog);
-    }
+    *s = (Stream){0};
+    s->region_size = region_size;
+    if (headless) return;
 
+    glGenBuffers(1, &s->vbo);
+    gl_bind_array_buffer(s->vbo);
+    glBufferData(GL_ARRAY_BUFFER, region_size * STREAM_FRAMES, NULL, GL_STREAM_DRAW);
 }
-void 
-draw_line(float x1, float y1, float x2, float y2) 
+
+void
+stream_wait(Stream *s, unsigned int region)
 {
-    float dx = x2 - x1;
-    float dy = y2 - y1;
-        
-    float length = SDL_sqrt(dx*dx + dy*dy);
-    float angle  = SDL_atan2(dy, dx);
+    GLsync fence = s->fence[region];
+    if (!fence) return;
 
-    float vert[] = {
-         0.0f, 0.0f, 0.0f,
-         1.0f, 0.0f, 0.0f
-    };
-    
-    unsigned int vao, vbo;
-    vao_init(&vao, &vbo, vert, sizeof(vert));
-    draw(GL_LINES, &(Vector2){x1, y1}, &(Vector2){length, 1.0f}, angle, vao, 2);
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        s->stalls++;
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) 
+                == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(fence);
+    s->fence[region] = 0;
 }
 
-void 
-draw_line_a(float x1, float y1, float x2, float y2, float angle) 
+void
+stream_begin_frame(Stream *s)
 {
-    float dx = x2 - x1;
-    float dy = y2 - y1;
-        
-    float length = SDL_sqrt(dx*dx + dy*dy);
-
-    float vert[] = {
-         -1.0f, 0.0f, 0.0f,
-         1.0f, 0.0f, 0.0f
-    };
-    
-    unsigned int vao, vbo;
-    vao_init(&vao, &vbo, vert, sizeof(vert));
-    draw(GL_LINES, &(Vector2){x1, y1}, &(Vector2){length, 1.0f}, angle, vao, 2);
+    s->region = (s->region + 1) % STREAM_FRAMES;
+    s->offset = 0;
+    s->stalls = 0;
+    s->map_fails = 0;
+    s->bytes = 0;
+    stream_wait(s, s->region);
 }
+
 void
-draw_line_v(Vector2 pos, Vector2 end_pos) 
+stream_end_frame(Stream *s)
 {
-    draw_line(pos.x, pos.y, end_pos.x, end_pos.y);
+    if (!headless) {
+        s->fence[s->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    s->last_bytes = s->bytes;
+    s->frames++;
+    s->total_stalls += s->stalls;
+    s->total_map_fails += s->map_fails;
+    s->total_bytes += s->bytes;
 }
 
+/* Regions only grow when a single frame outgrows one; all in-flight
+ * regions are drained first and the old storage is orphaned. */
 void
-draw_asteroid(Asteroid *asteroid , Renderer *renderer)
+stream_grow(Stream *s, unsigned int need)
 {
-    SDL_srand(asteroid->seed);
-    int n = 7 + SDL_rand(13 - 7 + 1); 
-    float vert[(n) * 3];  
-    
-    int index = 0;
-    for(int i = 0; i < n; i++) {
-        float radius = 0.6f * (1.0f + (-0.5 + SDL_randf() * (0.5 - (-0.5))));
-        float angle = ((TAU * (float)(i)) / (float)n); 
-        float x = radius * SDL_cosf(angle);
-        float y = radius * SDL_sinf(angle);
-        
-        vert[index++] = x;
-        vert[index++] = y;
-        vert[index++] = 0.0f;
+    for(int i = 0; i < STREAM_FRAMES; i++) {
+        stream_wait(s, i);
     }
-    
-    update_renderer(renderer, vert, n * 3 * sizeof(float));
+    while (s->region_size < need) s->region_size *= 2;
 
-    draw(GL_LINE_LOOP, &asteroid->pos, &asteroid->size, asteroid->angle, renderer->vao, n);    
+    gl_bind_array_buffer(s->vbo);
+    glBufferData(GL_ARRAY_BUFFER, s->region_size * STREAM_FRAMES, NULL, GL_STREAM_DRAW);
+    gl_count(1);
+    s->region = 0;
+    s->offset = 0;
 }
 
-void
-b_append_pos(Bullet *p, Vector2 *pos, Vector2 *dir, Uint32 counter1)
+/* Copies size bytes into the current region and returns the buffer offset. */
+unsigned int
+stream_push(Stream *s, const void *data, unsigned int size)
 {
-    p->pos[p->size].x = pos->x;
-    p->pos[p->size].y = pos->y;
-    p->dir[p->size].x = dir->x;
-    p->dir[p->size].y = dir->y;
-    p->time[p->size] = counter1;
+    unsigned int aligned = (size + 15) & ~15u;
+    if (headless) {
+        s->bytes += size;
+        return 0;
+    }
+    if (s->offset + aligned > s->region_size) {
+        stream_grow(s, s->offset + aligned);
+    }
 
-    p->size++;
-    if(p->size >= CAPACITY) {
-        p->size = 0;
+    unsigned int offset = s->region * s->region_size + s->offset;
+    gl_bind_array_buffer(s->vbo);
+    void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, size,
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    if (dst) {
+        SDL_memcpy(dst, data, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    } else {
+        if (s->total_map_fails + s->map_fails == 0) {
+            SDL_Log("stream: map of %u bytes failed (GL error 0x%x), using glBufferSubData\n",
+                    size, glGetError());
+        }
+        s->map_fails++;
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
     }
+    gl_count(2);
+
+    s->offset += aligned;
+    s->bytes += size;
+    return offset;
 }
 
+Batch
+batch_init(GLenum mode, Shader *sh)
+{
+    Batch b = {0};
+    b.mode = mode;
+    b.sh = sh;
+    if (headless) return b;
 
+    glGenVertexArrays(1, &b.vao);
+    gl_bind_vao(b.vao);
+    glEnableVertexAttribArray(sh->attrib[A_POS]);
+    return b;
+}
 
 void
-min_max(float *min, float *max, float *min_vel, float *max_vel, ASTEROID_SIZE as) 
+batch_reserve(Batch *b, int n)
 {
-    switch (as) {
-        case BIG:
-            *min = 60.0f;
-            *min_vel = PLAYER_SPEED * 2;
-            *max_vel = PLAYER_SPEED * 3.9;
-            *max = 90.0f;
-            break;
-        case MEDIUM:
-            *min = 40.0f;
-            *min_vel = PLAYER_SPEED * 4;
-            *max_vel = PLAYER_SPEED * 6.5;
-            *max = 59.0f;
-            break;
-        case SMALL:
-            *min = 10.0f;
-            *min_vel = PLAYER_SPEED * 7;
-            *max_vel = PLAYER_SPEED * 10;
-            *max = 35.0f;
-            break;
-        case DEAD:
-            break;
+    if (n > b->cap_v) {
+        b->cap_v = SDL_max(SDL_max(b->cap_v * 2, 64), n);
+        b->vert = SDL_realloc(b->vert, b->cap_v * 3 * sizeof(float));
     }
+}
 
+void
+batch_vertex(Batch *b, float x, float y)
+{
+    batch_reserve(b, b->nr_v + 1);
+    float *v = &b->vert[b->nr_v++ * 3];
+    v[0] = x;
+    v[1] = y;
+    v[2] = 0.0f;
 }
-void 
-get_rand_ast_size_vel(Asteroid *asteroid)
+
+void
+batch_point(Batch *b, Vector2 pos)
 {
-    float min = 0, max = 0;
-    float min_vel = 0, max_vel = 0;
-    min_max(&min, &max, &min_vel, &max_vel, asteroid->as);
-    asteroid->size.x = min + SDL_randf() * (max - min); 
-    asteroid->size.y = min + SDL_randf() * (max - min);
-    asteroid->vel =  min_vel + SDL_randf() * (max_vel - min_vel);
+    batch_vertex(b, pos.x, pos.y);
 }
 
-void 
-get_rand_ast(Asteroid *asteroid)
+/* Immediate-mode lines for effects and debug overlays. Everything lands in
+ * the frame's `lines` batch and is flushed with a single GL_LINES draw. */
+void
+line(float x1, float y1, float x2, float y2)
 {
-    asteroid->pos.x = SDL_randf() * R_WIDTH;
-    asteroid->pos.y = SDL_randf() * R_HEIGHT;
-    get_rand_ast_size_vel(asteroid); 
-    asteroid->angle = ((SDL_randf() * 2.0f) - 1.0f) * TAU;
-    asteroid->seed = SDL_rand_bits();
+    batch_vertex(&lines, x1, y1);
+    batch_vertex(&lines, x2, y2);
 }
 
-Vector2
-drw_t(Vector2 *p, Vector2 *size) {
-    Vector2 tmp = {-100, -100};
-    if (p->x - (size->x ) < 0){
-        tmp.x = p->x + R_WIDTH;
-        tmp.y = p->y;
+void
+polyline(const Vector2 *pts, int n, bool closed)
+{
+    for(int i = 0; i + 1 < n; i++) {
+        line(pts[i].x, pts[i].y, pts[i + 1].x, pts[i + 1].y);
     }
-    if (p->y - (size->y) < 0){
-        tmp.y = p->y + R_HEIGHT;
-        tmp.x = p->x;
+    if (closed && n > 2) {
+        line(pts[n - 1].x, pts[n - 1].y, pts[0].x, pts[0].y);
     }
-    if (p->x + (size->x) > R_WIDTH){
-        tmp.x = p->x - R_WIDTH;
-        tmp.y = p->y;
+}
+
+void
+circle(Vector2 c, float r, int segments)
+{
+    float px = c.x + r, py = c.y;
+    for(int i = 1; i <= segments; i++) {
+        float a = (TAU * (float)i) / (float)segments;
+        float x = c.x + r * SDL_cosf(a);
+        float y = c.y + r * SDL_sinf(a);
+        line(px, py, x, y);
+        px = x;
+        py = y;
     }
-    if (p->y + (size->y) > R_HEIGHT){
-        tmp.y = p->y - R_HEIGHT;
-        tmp.x = p->x;
+}
+
+void
+batch_flush(Batch *b)
+{
+    if (b->nr_v == 0) return;
+
+    unsigned int offset = stream_push(&stream, b->vert, b->nr_v * 3 * sizeof(float));
+    gl.draws++;
+    gl.vertices += b->nr_v;
+    if (headless) {
+        b->nr_v = 0;
+        return;
     }
-    return tmp;
+
+    gl_use_program(b->sh->program);
+    gl_bind_vao(b->vao);
+    glVertexAttribPointer(b->sh->attrib[A_POS], 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float),
+            (void*)(uintptr_t)offset);
+    glDrawArrays(b->mode, 0, b->nr_v);
+    gl_count(2);
+    b->nr_v = 0;
 }
 
-bool collision(Vector2 *pos1, Vector2 *pos2, Vector2 *size) {
-    if(SDL_sqrtf((pos1->x - pos2->x) * (pos1->x - pos2->x) + 
-                (pos1->y - pos2->y) * (pos1->y - pos2->y)) < (size->x / 2)) {
-        return true;
+Instances
+instances_init(Shader *sh, int copies)
+{
+    Instances in = {0};
+    in.sh = sh;
+    in.copies = copies;
+    if (headless) return in;
 
+    glGenVertexArrays(1, &in.vao);
+    gl_bind_vao(in.vao);
+    for(int i = A_POS_SIZE; i <= A_SHAPE; i++) {
+        glEnableVertexAttribArray(sh->attrib[i]);
+        glVertexAttribDivisor(sh->attrib[i], copies);
     }
-    if(SDL_sqrtf((pos1->x - pos2->x) * (pos1->x - pos2->x) + 
-                (pos1->y - pos2->y) * (pos1->y - pos2->y)) < (size->y / 2)) {
-        return true;
 
+    return in;
+}
+
+void
+instances_reserve(Instances *in, int cap)
+{
+    if (cap > in->cap) {
+        in->cap = SDL_max(SDL_max(in->cap * 2, 64), cap);
+        in->data = SDL_realloc(in->data, in->cap * sizeof(Instance));
     }
-    return false;
 }
 
-bool 
-ast_collision(Vector2 *pos, Asteroid *asteroid, size_t *ast_size)
-{
-    for(size_t i = 0; i < *ast_size; i++) {
-        bool r = collision(pos, &asteroid[i].pos, &asteroid[i].size);
-        Uint32 tick = SDL_GetTicks() + 1300;
-        if(r && SDL_GetTicks() > asteroid[i].time){
-            switch (asteroid[i].as) {
-                case BIG:
-                    asteroid[i].as = MEDIUM;
-                    //get_rand_ast(&asteroid[i]);
-                    get_rand_ast_size_vel(&asteroid[i]);
-                    asteroid[i].angle = ((SDL_randf() * 2.0f) - 1.0f) * TAU;
-                    asteroid[i].seed = SDL_rand_bits();
-                    asteroid[i].time = tick;
-                    
-                    asteroid[*ast_size].as = MEDIUM;
-                    asteroid[*ast_size].time = tick;
-                    get_rand_ast(&asteroid[*ast_size]);
-                    asteroid[*ast_size].pos.x = asteroid[i].pos.x;
-                    asteroid[*ast_size].pos.y = asteroid[i].pos.y + asteroid[i].size.y;
-                    
-                    asteroid[*ast_size + 1].as = MEDIUM;
-                    asteroid[*ast_size + 1].time = tick;
-                    get_rand_ast(&asteroid[*ast_size + 1]);
-                    asteroid[*ast_size + 1].pos.x = asteroid[*ast_size].pos.x + asteroid[*ast_size].size.x;
-                    asteroid[*ast_size + 1].pos.y = asteroid[*ast_size].pos.y + (asteroid[*ast_size].size.y / 2);
-                    
-                    *ast_size += 2;
-                    break;
-                case MEDIUM:
-                    asteroid[i].as = SMALL;
-                    //get_rand_ast(&asteroid[i]);
-                    get_rand_ast_size_vel(&asteroid[i]); 
-                    asteroid[i].angle = ((SDL_randf() * 2.0f) - 1.0f) * TAU;
-                    asteroid[i].seed = SDL_rand_bits();
-                    asteroid[i].time = tick;
-                    
-                    asteroid[*ast_size].as = SMALL;
-                    get_rand_ast(&asteroid[*ast_size]);
-                    asteroid[*ast_size].time = tick;
-                    asteroid[*ast_size].pos.x = asteroid[i].pos.x;
-                    asteroid[*ast_size].pos.y = asteroid[i].pos.y + asteroid[i].size.y;
-
-                    *ast_size += 1;
-                    break;
-                case SMALL:
-                    asteroid[i].time = tick;
-                    asteroid[i].as = DEAD;
-                    //for(size_t j = i; j < *ast_size - 1; j++){
-                    //    asteroid[j] = asteroid[j + 1];
-                    //}
-                    //*ast_size -= 1;
-                    break;
-                case DEAD:
-                    break;
-            }
-            return true;
-        }
-    } 
-   return false;
+void
+instance_push(Instances *in, Vector2 *pos, Vector2 *size, float angle, int shape)
+{
+    instances_reserve(in, in->size + 1);
+    in->data[in->size++] = (Instance){pos->x, pos->y, size->x, size->y, angle, shape};
 }
 
-int
-main(int argc, char **argv)
+void
+instances_flush(Instances *in)
 {
-    (void)argc;
-    (void)argv;
+    if (in->size == 0) return;
 
-    SDL_Window *window = init_window(1280, 720);
-    /* This makes our buffer swap syncronized with the monitor's vertical refresh */
-    SDL_GL_SetSwapInterval(1);
-    uint8_t running = 1;
-    SDL_srand(0);
+    uintptr_t offset = stream_push(&stream, in->data, in->size * sizeof(Instance));
+    gl.draws++;
+    gl.vertices += in->size * in->copies * SHAPE_STRIDE;
+    if (headless) {
+        in->size = 0;
+        return;
+    }
 
-    float vertices[] = {
-        -0.4f, -0.5f, 0.0f,
-        -0.2f, -0.4f, 0.0f,
-         0.2f, -0.4f, 0.0f,
-         0.4f, -0.5f, 0.0f,
+    int *attrib = in->sh->attrib;
+    gl_use_program(in->sh->program);
+    glBindTexture(GL_TEXTURE_BUFFER, shapes.tex);
+    gl_bind_vao(in->vao);
+    glVertexAttribPointer(attrib[A_POS_SIZE], 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+            (void*)offset);
+    glVertexAttribPointer(attrib[A_ANGLE], 1, GL_FLOAT, GL_FALSE, sizeof(Instance),
+            (void*)(offset + offsetof(Instance, angle)));
+    glVertexAttribIPointer(attrib[A_SHAPE], 1, GL_INT, sizeof(Instance),
+            (void*)(offset + offsetof(Instance, shape)));
+    glUniform1i(in->sh->uniform[U_COPIES], in->copies);
+    glDrawArraysInstanced(GL_LINE_STRIP, 0, SHAPE_STRIDE, in->size * in->copies);
+    gl_count(6);
+    in->size = 0;
+}
+
+Vector2
+vector2_scale(Vector2 *vec, const float s)
+{
+    Vector2 r;
+    r.x = vec->x * s;
+    r.y = vec->y * s;
+    return r;
+}
+
+Vector2 
+vector2_add(Vector2 a, Vector2 b)
+{
+    Vector2 r;
+    r.x = a.x + b.x;
+    r.y = a.y + b.y;
+    return r;
+}
+
+Vector2
+vector2_modf(Vector2 a, const float d1, const float d2)
+{
+    Vector2 v;
+    v.x =  SDL_fmodf(SDL_fmodf(a.x, d1) + d1, d1);
+    v.y =  SDL_fmodf(SDL_fmodf(a.y, d2) + d2, d2);
+    return v;
+}
+
+/* A step longer than half the world is a wrap; snap rather than sweep
+ * across the screen. */
+Vector2
+vector2_lerp_wrap(Vector2 a, Vector2 b, float t)
+{
+    if (SDL_fabsf(b.x - a.x) > R_WIDTH * 0.5f || SDL_fabsf(b.y - a.y) > R_HEIGHT * 0.5f) {
+        return b;
+    }
+    Vector2 r;
+    r.x = a.x + (b.x - a.x) * t;
+    r.y = a.y + (b.y - a.y) * t;
+    return r;
+}
+
+Vector2 
+get_direction(float angle) 
+{
+    Vector2 dir;
+    dir.x = SDL_cosf(angle + (PI * 0.5f));
+    dir.y = SDL_sinf(angle + (PI * 0.5f));
+    return dir;
+}
+
+/* Returns 0 and logs the full info log, tagged with the pipeline and stage. */
+unsigned int
+shader_compile(const char *name, GLenum stage, const char *src)
+{
+    unsigned int id = glCreateShader(stage);
+    glShaderSource(id, 1, &src, 0);
+    glCompileShader(id);
+
+    int success, len;
+    glGetShaderiv(id, GL_COMPILE_STATUS, &success);
+    if(!success) {
+        glGetShaderiv(id, GL_INFO_LOG_LENGTH, &len);
+        char *log = SDL_malloc(len + 1);
+        glGetShaderInfoLog(id, len + 1, NULL, log);
+        SDL_Log("ERROR SHADER %s %s COMPILATION_FAILED\n%s\n", name,
+                stage == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT", log);
+        SDL_free(log);
+        glDeleteShader(id);
+        return 0;
+    }
+    return id;
+}
+
+bool
+shader_link(Shader *sh)
+{
+    unsigned int vs = shader_compile(sh->name, GL_VERTEX_SHADER, sh->vs);
+    unsigned int fs = sh->fs ? shader_compile(sh->name, GL_FRAGMENT_SHADER, sh->fs) : 0;
+    if (!vs || (sh->fs && !fs)) {
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        return false;
+    }
+
+    sh->program = glCreateProgram();
+    glAttachShader(sh->program, vs);
+    if (fs) glAttachShader(sh->program, fs);
+    if (sh->feedback) {
+        glTransformFeedbackVaryings(sh->program, sh->nr_feedback, sh->feedback,
+                GL_INTERLEAVED_ATTRIBS);
+    }
+    glLinkProgram(sh->program);
+    glDeleteShader(vs);
+    if (fs) glDeleteShader(fs);
+
+    int success, len;
+    glGetProgramiv(sh->program, GL_LINK_STATUS, &success);
+    if(!success) {
+        glGetProgramiv(sh->program, GL_INFO_LOG_LENGTH, &len);
+        char *log = SDL_malloc(len + 1);
+        glGetProgramInfoLog(sh->program, len + 1, NULL, log);
+        SDL_Log("ERROR SHADER %s LINK_FAILED\n%s\n", sh->name, log);
+        SDL_free(log);
+        glDeleteProgram(sh->program);
+        sh->program = 0;
+        return false;
+    }
+
+    for(int i = 0; i < U_COUNT; i++) {
+        sh->uniform[i] = glGetUniformLocation(sh->program, uniform_names[i]);
+    }
+    for(int i = 0; i < A_COUNT; i++) {
+        sh->attrib[i] = glGetAttribLocation(sh->program, attrib_names[i]);
+    }
+    return true;
+}
+
+/* Needs a context; a headless run only has one for GPU particles. */
+void
+pipelines_init(void)
+{
+    if (!con) return;
+    for(int i = 0; i < PIPE_COUNT; i++) {
+        if (!shader_link(&pipelines[i])) {
+            ERROR_EXIT(1, "Failed to build pipeline %s\n", pipelines[i].name);
+        }
+    }
+}
+
+/* Setup-time lookup only; per-draw code holds the Shader pointer. */
+Shader
+*pipeline_find(const char *name)
+{
+    for(int i = 0; i < PIPE_COUNT; i++) {
+        if (SDL_strcmp(pipelines[i].name, name) == 0) return &pipelines[i];
+    }
+    return NULL;
+}
+
+void
+pipelines_destroy(void)
+{
+    if (!con) return;
+    for(int i = 0; i < PIPE_COUNT; i++) {
+        glDeleteProgram(pipelines[i].program);
+        pipelines[i].program = 0;
+    }
+}
+
+/* Draws s with its top-left at (x, y); each glyph cell is 4x6 * scale. */
+void
+text(float x, float y, float scale, const char *s)
+{
+    for(; *s; s++, x += 6.0f * scale) {
+        int ch = (*s >= 'a' && *s <= 'z') ? *s - 'a' + 'A' : *s;
+        const char *g = (ch > 0 && ch < 128) ? glyphs[ch] : NULL;
+        if (!g) continue;
+
+        bool pen = false;
+        float px = 0, py = 0;
+        for(; g[0]; g++) {
+            if (g[0] == ' ') { pen = false; continue; }
+            float gx = x + (g[0] - '0') * scale;
+            float gy = y + (g[1] - '0') * scale;
+            if (pen) line(px, py, gx, gy);
+            px = gx;
+            py = gy;
+            pen = true;
+            g++;
+        }
+    }
+}
+
+/* A segment of half-length |p2 - p1| centred on p1, rotated by angle. */
+void
+line_a(float x1, float y1, float x2, float y2, float angle)
+{
+    float dx = x2 - x1;
+    float dy = y2 - y1;
+        
+    float length = SDL_sqrtf(dx*dx + dy*dy);
+    float c = length * SDL_cosf(angle);
+    float s = length * SDL_sinf(angle);
+
+    line(x1 - c, y1 - s, x1 + c, y1 + s);
+}
+
+void
+prof_init(Profiler *pr)
+{
+    *pr = (Profiler){0};
+    pr->freq = SDL_GetPerformanceFrequency();
+    for(int i = 0; i < PROF_FRAMES; i++) {
+        for(int j = 0; j < P_COUNT; j++) pr->ms[i][j] = -1.0f;
+    }
+    if (!headless) glGenQueries(PROF_LAG, pr->query);
+}
+
+void
+prof_destroy(Profiler *pr)
+{
+    if (!headless) glDeleteQueries(PROF_LAG, pr->query);
+}
+
+void
+prof_begin(Profiler *pr, PROF_SCOPE id)
+{
+    pr->depth[id] = pr->top++;
+    pr->start[id] = SDL_GetPerformanceCounter();
+}
+
+/* Re-entering a scope within a frame adds to its time. */
+void
+prof_end(Profiler *pr, PROF_SCOPE id)
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    float *ms = &pr->ms[pr->frame % PROF_FRAMES][id];
+    if (*ms < 0.0f) *ms = 0.0f;
+    *ms += (float)((double)(now - pr->start[id]) * 1000.0 / (double)pr->freq);
+    pr->top--;
+}
+
+/* Picks up finished queries without waiting on any of them. */
+void
+prof_collect(Profiler *pr)
+{
+    for(int i = 0; i < PROF_LAG; i++) {
+        if (!pr->pending[i]) continue;
+
+        GLuint ready = 0;
+        glGetQueryObjectuiv(pr->query[i], GL_QUERY_RESULT_AVAILABLE, &ready);
+        gl_count(1);
+        if (!ready) continue;
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(pr->query[i], GL_QUERY_RESULT, &ns);
+        gl_count(1);
+        pr->pending[i] = false;
+        if (pr->frame - pr->query_frame[i] < PROF_FRAMES) {
+            pr->ms[pr->query_frame[i] % PROF_FRAMES][P_GPU] = (float)((double)ns / 1e6);
+        }
+    }
+}
+
+void
+prof_begin_frame(Profiler *pr)
+{
+    pr->frame++;
+    float *row = pr->ms[pr->frame % PROF_FRAMES];
+    for(int i = 0; i < P_COUNT; i++) row[i] = -1.0f;
+    pr->top = 0;
+    prof_begin(pr, P_FRAME);
+}
+
+void
+prof_end_frame(Profiler *pr)
+{
+    prof_end(pr, P_FRAME);
+}
+
+/* A query slot still in flight when its turn comes round again leaves
+ * that frame's GPU time unmeasured rather than blocking on it. The first
+ * frame is skipped too; some drivers fold context start-up into it. */
+void
+prof_gpu_begin(Profiler *pr)
+{
+    if (headless) return;
+    prof_collect(pr);
+
+    int q = pr->frame % PROF_LAG;
+    pr->timing = !pr->pending[q] && pr->frame > 1;
+    if (!pr->timing) return;
+    glBeginQuery(GL_TIME_ELAPSED, pr->query[q]);
+    gl_count(1);
+    pr->query_frame[q] = pr->frame;
+}
+
+void
+prof_gpu_end(Profiler *pr)
+{
+    if (!pr->timing) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    gl_count(1);
+    pr->pending[pr->frame % PROF_LAG] = true;
+    pr->timing = false;
+}
+
+static int
+cmp_float(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+/* min/avg/p99 over the frames still in the ring; returns the sample count. */
+int
+prof_stats(Profiler *pr, PROF_SCOPE id, float *min, float *avg, float *p99)
+{
+    static float v[PROF_FRAMES];
+    int n = 0;
+    double sum = 0.0;
+    for(int i = 0; i < PROF_FRAMES; i++) {
+        if (i == (int)(pr->frame % PROF_FRAMES) && pr->top > 0) continue;
+        float ms = pr->ms[i][id];
+        if (ms < 0.0f) continue;
+        v[n++] = ms;
+        sum += ms;
+    }
+    *min = *avg = *p99 = 0.0f;
+    if (n == 0) return 0;
+
+    SDL_qsort(v, n, sizeof(float), cmp_float);
+    *min = v[0];
+    *avg = (float)(sum / n);
+    *p99 = v[(n * 99 + 99) / 100 - 1];
+    return n;
+}
+
+/* Frame and GPU time of the last PROF_GRAPH frames as 1 px bars, scaled so
+ * the full height is two 60 Hz frames with one frame marked, followed by
+ * the average of each scope indented by nesting depth. */
+void
+prof_draw(Profiler *pr, float x, float y)
+{
+    const float h = 60.0f, full = 2000.0f / 60.0f;
+    char buf[64];
+
+    for(int g = 0; g < 2; g++) {
+        PROF_SCOPE id = g ? P_GPU : P_FRAME;
+        float base = y + 20.0f + h + g * (h + 30.0f);
+        text(x, base - h - 16.0f, 2.0f, prof_names[id]);
+        line(x, base - h * 0.5f, x + PROF_GRAPH, base - h * 0.5f);
+        for(int i = 0; i < PROF_GRAPH; i++) {
+            Sint64 f = (Sint64)pr->frame - PROF_GRAPH + i;
+            if (f < 0) continue;
+            float ms = pr->ms[f % PROF_FRAMES][id];
+            if (ms < 0.0f) continue;
+            line(x + i, base, x + i, base - h * SDL_min(ms, full) / full);
+        }
+    }
+
+    y += 2.0f * (h + 30.0f) + 20.0f;
+    for(int i = 0; i < P_COUNT; i++) {
+        float min, avg, p99;
+        prof_stats(pr, i, &min, &avg, &p99);
+        SDL_snprintf(buf, sizeof(buf), "%s %.2f", prof_names[i], avg);
+        text(x + pr->depth[i] * 12.0f, y + i * 16.0f, 2.0f, buf);
+    }
+}
+
+void
+prof_write_csv(Profiler *pr, const char *path)
+{
+    SDL_IOStream *io = SDL_IOFromFile(path, "w");
+    if (!io) {
+        SDL_Log("Could not write %s: %s\n", path, SDL_GetError());
+        return;
+    }
+
+    SDL_IOprintf(io, "scope,depth,samples,min_ms,avg_ms,p99_ms\n");
+    for(int i = 0; i < P_COUNT; i++) {
+        float min, avg, p99;
+        int n = prof_stats(pr, i, &min, &avg, &p99);
+        SDL_IOprintf(io, "%s,%d,%d,%.4f,%.4f,%.4f\n", prof_names[i],
+                pr->depth[i], n, min, avg, p99);
+    }
+    SDL_CloseIO(io);
+    SDL_Log("profile: wrote %s\n", path);
+}
+
+/* The same table as prof_write_csv, to the log. */
+void
+prof_report(Profiler *pr)
+{
+    SDL_Log("%-14s %7s %9s %9s %9s\n", "scope", "samples", "min ms", "avg ms", "p99 ms");
+    for(int i = 0; i < P_COUNT; i++) {
+        float min, avg, p99;
+        int n = prof_stats(pr, i, &min, &avg, &p99);
+        if (n == 0) continue;
+        SDL_Log("%*s%-*s %7d %9.3f %9.3f %9.3f\n", pr->depth[i] * 2, "",
+                14 - pr->depth[i] * 2, prof_names[i], n, min, avg, p99);
+    }
+}
+
+/* CPU time of the whole process so far, every thread included, in ns. */
+Uint64
+cpu_time_ns(void)
+{
+#ifdef _WIN32
+    FILETIME created, ended, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &created, &ended, &kernel, &user);
+    Uint64 k = (Uint64)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime;
+    Uint64 u = (Uint64)user.dwHighDateTime << 32 | user.dwLowDateTime;
+    return (k + u) * 100;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (Uint64)ts.tv_sec * SDL_NS_PER_SECOND + (Uint64)ts.tv_nsec;
+#endif
+}
+
+void
+present_report(Present *pr)
+{
+    if (pr->frames < 2) return;
+    double n = (double)(pr->frames - 1);
+    double wall = (double)(SDL_GetTicksNS() - pr->wall_start);
+    double cpu = (double)(cpu_time_ns() - pr->cpu_start);
+    SDL_Log("present: %s%s, %llu frames, %.3f ms avg, %.3f ms stddev, %.3f ms worst, "
+            "cpu %.0f%% of a core\n", present_names[pr->mode], pr->finish ? " + finish" : "",
+            (unsigned long long)pr->frames, pr->mean, SDL_sqrt(pr->m2 / n), pr->worst,
+            wall > 0.0 ? 100.0 * cpu / wall : 0.0);
+}
+
+/* Reports the mode being left, then switches and starts its stats over.
+ * Adaptive vsync falls back to plain vsync where the driver refuses it. */
+void
+present_set(Present *pr, PRESENT_MODE mode, bool finish)
+{
+    present_report(pr);
+    pr->mode = mode;
+    pr->finish = finish;
+    if (!headless) {
+        int interval = mode == PRESENT_VSYNC ? 1 : mode == PRESENT_ADAPTIVE ? -1 : 0;
+        if (!SDL_GL_SetSwapInterval(interval) && mode == PRESENT_ADAPTIVE) {
+            SDL_Log("present: adaptive vsync unavailable (%s), using vsync\n", SDL_GetError());
+            pr->mode = PRESENT_VSYNC;
+            SDL_GL_SetSwapInterval(1);
+        }
+    }
+    pr->frames = 0;
+    pr->mean = pr->m2 = 0.0;
+    pr->worst = 0.0f;
+    pr->next = 0;
+    pr->last = pr->wall_start = SDL_GetTicksNS();
+    pr->cpu_start = cpu_time_ns();
+}
+
+/* Sleeps to within PRESENT_SPIN_NS of the next 1/fps deadline and spins
+ * the rest. Deadlines advance by a fixed period so error does not
+ * accumulate; a frame that overran by a whole period restarts them. */
+void
+present_limit(Present *pr)
+{
+    Uint64 period = SDL_NS_PER_SECOND / (Uint64)pr->fps;
+    Uint64 now = SDL_GetTicksNS();
+    if (pr->next == 0 || now > pr->next + period) pr->next = now;
+    pr->next += period;
+    if (pr->next > now + PRESENT_SPIN_NS) {
+        SDL_DelayNS(pr->next - now - PRESENT_SPIN_NS);
+    }
+    while(SDL_GetTicksNS() < pr->next) SDL_CPUPauseInstruction();
+}
+
+/* Runs right after the swap: glFinish caps the GPU queue at this frame,
+ * the limiter paces capped mode, then the frame time goes into the
+ * running mean and variance (Welford). */
+void
+present_frame(Present *pr)
+{
+    if (pr->finish && !headless) glFinish();
+    if (pr->mode == PRESENT_CAPPED) present_limit(pr);
+
+    Uint64 now = SDL_GetTicksNS();
+    float ms = (float)((double)(now - pr->last) / 1e6);
+    pr->last = now;
+    if (pr->frames++ == 0) return;
+    double d = ms - pr->mean;
+    pr->mean += d / (double)(pr->frames - 1);
+    pr->m2 += d * (ms - pr->mean);
+    pr->worst = SDL_max(pr->worst, ms);
+}
+
+void
+shape_cache_init(ShapeCache *cache, int cap)
+{
+    cache->cap = cap;
+    cache->vert = SDL_malloc(cap * SHAPE_STRIDE * 2 * sizeof(float));
+    cache->sx = SDL_malloc(cap * SHAPE_STRIDE * sizeof(float));
+    cache->sy = SDL_malloc(cap * SHAPE_STRIDE * sizeof(float));
+    cache->free = SDL_malloc(cap * sizeof(int));
+    cache->nr_free = cap;
+    for(int i = 0; i < cap; i++) {
+        cache->free[i] = cap - 1 - i;
+    }
+    if (headless) return;
+
+    glGenBuffers(1, &cache->vbo);
+    glBindBuffer(GL_TEXTURE_BUFFER, cache->vbo);
+    glBufferData(GL_TEXTURE_BUFFER, cap * SHAPE_STRIDE * 2 * sizeof(float),
+            NULL, GL_STATIC_DRAW);
+
+    glGenTextures(1, &cache->tex);
+    glBindTexture(GL_TEXTURE_BUFFER, cache->tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, cache->vbo);
+}
+
+void
+shape_cache_grow(ShapeCache *cache)
+{
+    int old = cache->cap;
+    cache->cap *= 2;
+    cache->vert = SDL_realloc(cache->vert, cache->cap * SHAPE_STRIDE * 2 * sizeof(float));
+    cache->sx = SDL_realloc(cache->sx, cache->cap * SHAPE_STRIDE * sizeof(float));
+    cache->sy = SDL_realloc(cache->sy, cache->cap * SHAPE_STRIDE * sizeof(float));
+    cache->free = SDL_realloc(cache->free, cache->cap * sizeof(int));
+    for(int i = cache->cap - 1; i >= old; i--) {
+        cache->free[cache->nr_free++] = i;
+    }
+    if (headless) return;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, cache->vbo);
+    glBufferData(GL_TEXTURE_BUFFER, cache->cap * SHAPE_STRIDE * 2 * sizeof(float),
+            NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, old * SHAPE_STRIDE * 2 * sizeof(float),
+            cache->vert);
+}
+
+void
+shape_cache_reserve(ShapeCache *cache, int n)
+{
+    while(cache->nr_free < n) shape_cache_grow(cache);
+}
+
+/* Stores n xyz vertices as one padded slot and uploads it. */
+int
+shape_store(ShapeCache *cache, const float *vert, int n, bool loop)
+{
+    if (cache->nr_free == 0) shape_cache_grow(cache);
+    int slot = cache->free[--cache->nr_free];
+
+    float *dst = &cache->vert[slot * SHAPE_STRIDE * 2];
+    for(int i = 0; i < SHAPE_STRIDE; i++) {
+        int j = i < n ? i : (loop ? 0 : n - 1);
+        dst[i * 2]     = vert[j * 3];
+        dst[i * 2 + 1] = vert[j * 3 + 1];
+        cache->sx[slot * SHAPE_STRIDE + i] = vert[j * 3];
+        cache->sy[slot * SHAPE_STRIDE + i] = vert[j * 3 + 1];
+    }
+
+    if (!headless) {
+        glBindBuffer(GL_TEXTURE_BUFFER, cache->vbo);
+        glBufferSubData(GL_TEXTURE_BUFFER, slot * SHAPE_STRIDE * 2 * sizeof(float),
+                SHAPE_STRIDE * 2 * sizeof(float), dst);
+    }
+    return slot;
+}
+
+/* splitmix64 finaliser: spreads one seed into unrelated stream states. */
+Uint64
+rng_seed(Uint64 seed, int stream)
+{
+    Uint64 z = seed + (Uint64)(stream + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/* Folds n bytes into h eight at a time. Not cryptographic; it only has
+ * to make two diverging runs disagree. */
+Uint64
+hash_bytes(Uint64 h, const void *data, size_t n)
+{
+    const Uint8 *p = data;
+    for(; n >= 8; n -= 8, p += 8) {
+        Uint64 w;
+        SDL_memcpy(&w, p, 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 32;
+    }
+    for(; n > 0; n--, p++) {
+        h = (h ^ *p) * 0x100000001B3ull;
+    }
+    return h;
+}
+
+/* Shapes are a pure function of their seed, drawn from a private state. */
+int
+shape_alloc(ShapeCache *cache, int seed)
+{
+    Uint64 state = (Uint64)seed;
+    int n = 7 + SDL_rand_r(&state, 13 - 7 + 1); 
+    float vert[(SHAPE_STRIDE - 1) * 3];
+    
+    int index = 0;
+    for(int i = 0; i < n; i++) {
+        float radius = 0.6f * (1.0f + (-0.5 + SDL_randf_r(&state) * (0.5 - (-0.5))));
+        float angle = ((TAU * (float)(i)) / (float)n); 
+        float x = radius * SDL_cosf(angle);
+        float y = radius * SDL_sinf(angle);
+        
+        vert[index++] = x;
+        vert[index++] = y;
+        vert[index++] = 0.0f;
+    }
+
+    return shape_store(cache, vert, n, true);
+}
+
+void
+shape_free(ShapeCache *cache, int slot)
+{
+    cache->free[cache->nr_free++] = slot;
+}
+
+bool
+deque_push(JobDeque *d, Job *job)
+{
+    Uint32 b = SDL_GetAtomicU32(&d->bottom);
+    Uint32 t = SDL_GetAtomicU32(&d->top);
+    if (b - t >= JOB_DEQUE) return false;
+    SDL_SetAtomicPointer(&d->slot[b & (JOB_DEQUE - 1)], job);
+    SDL_SetAtomicU32(&d->bottom, b + 1);
+    return true;
+}
+
+/* Indices run on forever and wrap; they are only ever compared through
+ * their signed difference. */
+Job *
+deque_pop(JobDeque *d)
+{
+    Uint32 b = SDL_GetAtomicU32(&d->bottom) - 1;
+    SDL_SetAtomicU32(&d->bottom, b);
+    Uint32 t = SDL_GetAtomicU32(&d->top);
+    if ((Sint32)(b - t) < 0) {
+        SDL_SetAtomicU32(&d->bottom, b + 1);
+        return NULL;
+    }
+    Job *job = SDL_GetAtomicPointer(&d->slot[b & (JOB_DEQUE - 1)]);
+    if (t == b) {
+        /* Last one: race the thieves for it. */
+        if (!SDL_CompareAndSwapAtomicU32(&d->top, t, t + 1)) job = NULL;
+        SDL_SetAtomicU32(&d->bottom, b + 1);
+    }
+    return job;
+}
+
+Job *
+deque_steal(JobDeque *d)
+{
+    Uint32 t = SDL_GetAtomicU32(&d->top);
+    Uint32 b = SDL_GetAtomicU32(&d->bottom);
+    if ((Sint32)(b - t) <= 0) return NULL;
+    Job *job = SDL_GetAtomicPointer(&d->slot[t & (JOB_DEQUE - 1)]);
+    return SDL_CompareAndSwapAtomicU32(&d->top, t, t + 1) ? job : NULL;
+}
+
+Job *
+jobs_find(int self)
+{
+    Job *job = deque_pop(&jobs.deque[self]);
+    for(int k = 1; !job && k < jobs.threads; k++) {
+        job = deque_steal(&jobs.deque[(self + k) % jobs.threads]);
+    }
+    return job;
+}
+
+void
+jobs_run(Job *job, int self)
+{
+    JobDeque *d = &jobs.deque[self];
+    while(job->end - job->begin > job->grain) {
+        int chunks = (job->end - job->begin + job->grain - 1) / job->grain;
+        int mid = job->begin + chunks / 2 * job->grain;
+        Job *half = &d->ring[d->next];
+        *half = (Job){job->fn, job->data, mid, job->end, job->grain, job->left};
+        SDL_AddAtomicInt(job->left, 1);
+        if (!deque_push(d, half)) {
+            SDL_AddAtomicInt(job->left, -1);
+            break;
+        }
+        d->next = (d->next + 1) & (JOB_DEQUE - 1);
+        job->end = mid;
+        if (SDL_GetAtomicInt(&jobs.sleeping) > 0) SDL_SignalSemaphore(jobs.wake);
+    }
+    for(int c = job->begin; c < job->end; c += job->grain) {
+        job->fn(job->data, c, SDL_min(c + job->grain, job->end));
+    }
+    SDL_AddAtomicInt(job->left, -1);
+}
+
+int
+jobs_worker(void *data)
+{
+    int self = (int)(intptr_t)data;
+    while(!SDL_GetAtomicInt(&jobs.quit)) {
+        Job *job = jobs_find(self);
+        if (job) {
+            jobs_run(job, self);
+            continue;
+        }
+        SDL_AddAtomicInt(&jobs.sleeping, 1);
+        SDL_WaitSemaphore(jobs.wake);
+        SDL_AddAtomicInt(&jobs.sleeping, -1);
+    }
+    return 0;
+}
+
+/* threads <= 0 means one per logical core, the caller included. */
+void
+jobs_init(int threads)
+{
+    if (threads <= 0) threads = SDL_GetNumLogicalCPUCores();
+    jobs.threads = SDL_clamp(threads, 1, JOB_MAX_THREADS);
+    jobs.deque = SDL_aligned_alloc(AST_ALIGN, jobs.threads * sizeof(JobDeque));
+    if (!jobs.deque) {
+        ERROR_EXIT(1, "Out of memory for %d job queues\n", jobs.threads);
+    }
+    SDL_memset(jobs.deque, 0, jobs.threads * sizeof(JobDeque));
+    jobs.wake = SDL_CreateSemaphore(0);
+    SDL_SetAtomicInt(&jobs.quit, 0);
+    SDL_SetAtomicInt(&jobs.sleeping, 0);
+    for(int i = 1; i < jobs.threads; i++) {
+        jobs.thread[i] = SDL_CreateThread(jobs_worker, "worker", (void *)(intptr_t)i);
+        if (!jobs.thread[i]) {
+            ERROR_EXIT(1, "Cannot start worker %d: %s\n", i, SDL_GetError());
+        }
+    }
+}
+
+void
+jobs_shutdown(void)
+{
+    SDL_SetAtomicInt(&jobs.quit, 1);
+    for(int i = 1; i < jobs.threads; i++) SDL_SignalSemaphore(jobs.wake);
+    for(int i = 1; i < jobs.threads; i++) SDL_WaitThread(jobs.thread[i], NULL);
+    SDL_DestroySemaphore(jobs.wake);
+    SDL_aligned_free(jobs.deque);
+    jobs = (Jobs){0};
+}
+
+/* Chunk size for n items: base, raised so there are never more than
+ * JOB_MAX_CHUNKS. Depends only on n, never on the thread count. */
+int
+job_grain(int n, int base)
+{
+    int grain = SDL_max(base, (n + JOB_MAX_CHUNKS - 1) / JOB_MAX_CHUNKS);
+    return (grain + AST_BLOCK - 1) / AST_BLOCK * AST_BLOCK;
+}
+
+/* Calls fn over [0, n) in chunks of grain, spread over all threads, and
+ * returns once every chunk is done. The caller works and steals while it
+ * waits. Chunks must touch disjoint data. */
+void
+parallel_for(JobFn fn, void *data, int n, int grain)
+{
+    if (n <= 0) return;
+    Job root = {fn, data, 0, n, grain, NULL};
+    if (jobs.threads <= 1 || n <= grain) {
+        for(int c = 0; c < n; c += grain) fn(data, c, SDL_min(c + grain, n));
+        return;
+    }
+    SDL_AtomicInt left;
+    SDL_SetAtomicInt(&left, 1);
+    root.left = &left;
+    jobs_run(&root, 0);
+    while(SDL_GetAtomicInt(&left) > 0) {
+        Job *job = jobs_find(0);
+        if (job) jobs_run(job, 0);
+        else SDL_CPUPauseInstruction();
+    }
+}
+
+void *
+ast_resize(void *old, int count, int cap, size_t elem)
+{
+    void *p = SDL_aligned_alloc(AST_ALIGN, cap * elem);
+    if (!p) {
+        ERROR_EXIT(1, "Out of memory for %d asteroids\n", cap);
+    }
+    if (old) {
+        SDL_memcpy(p, old, count * elem);
+        SDL_aligned_free(old);
+    }
+    return p;
+}
+
+/* Room for cap asteroids. Indices and handles survive the copy; pointers
+ * into the arrays do not. */
+void
+asteroids_reserve(Asteroids *a, int cap)
+{
+    if (cap <= a->cap) return;
+    if ((Uint32)cap > AST_SLOT_MASK + 1) {
+        ERROR_EXIT(1, "Too many asteroids: %d\n", cap);
+    }
+    cap = SDL_max(cap, a->cap * 2);
+    cap = (cap + AST_CHUNK - 1) / AST_CHUNK * AST_CHUNK;
+    cap = SDL_min(cap, (int)AST_SLOT_MASK + 1);
+
+    a->x      = ast_resize(a->x,      a->size, cap, sizeof(float));
+    a->y      = ast_resize(a->y,      a->size, cap, sizeof(float));
+    a->dx     = ast_resize(a->dx,     a->size, cap, sizeof(float));
+    a->dy     = ast_resize(a->dy,     a->size, cap, sizeof(float));
+    a->radius = ast_resize(a->radius, a->size, cap, sizeof(float));
+    a->class  = ast_resize(a->class,  a->size, cap, sizeof(Uint8));
+    a->time   = ast_resize(a->time,   a->size, cap, sizeof(Uint32));
+    a->px     = ast_resize(a->px,     a->size, cap, sizeof(float));
+    a->py     = ast_resize(a->py,     a->size, cap, sizeof(float));
+    a->w      = ast_resize(a->w,      a->size, cap, sizeof(float));
+    a->h      = ast_resize(a->h,      a->size, cap, sizeof(float));
+    a->angle  = ast_resize(a->angle,  a->size, cap, sizeof(float));
+    a->cs     = ast_resize(a->cs,     a->size, cap, sizeof(float));
+    a->sn     = ast_resize(a->sn,     a->size, cap, sizeof(float));
+    a->seed   = ast_resize(a->seed,   a->size, cap, sizeof(int));
+    a->shape  = ast_resize(a->shape,  a->size, cap, sizeof(int));
+    a->id     = ast_resize(a->id,     a->size, cap, sizeof(AstHandle));
+
+    a->gen    = ast_resize(a->gen,    a->cap,     cap, sizeof(Uint32));
+    a->dense  = ast_resize(a->dense,  a->cap,     cap, sizeof(int));
+    a->free   = ast_resize(a->free,   a->nr_free, cap, sizeof(int));
+    for(int slot = cap - 1; slot >= a->cap; slot--) {
+        a->gen[slot] = 1;
+        a->free[a->nr_free++] = slot;
+    }
+    a->cap = cap;
+}
+
+void
+asteroids_init(Asteroids *a, int cap)
+{
+    *a = (Asteroids){0};
+    asteroids_reserve(a, cap);
+}
+
+void
+asteroids_destroy(Asteroids *a)
+{
+    void *arrays[] = {
+        a->x, a->y, a->dx, a->dy, a->radius, a->class, a->time,
+        a->px, a->py, a->w, a->h, a->angle, a->cs, a->sn, a->seed, a->shape,
+        a->id, a->gen, a->dense, a->free
+    };
+    for(size_t i = 0; i < SDL_arraysize(arrays); i++) {
+        SDL_aligned_free(arrays[i]);
+    }
+    *a = (Asteroids){0};
+}
+
+void
+ast_copy(Asteroids *a, int dst, int src)
+{
+    a->x[dst]      = a->x[src];
+    a->y[dst]      = a->y[src];
+    a->dx[dst]     = a->dx[src];
+    a->dy[dst]     = a->dy[src];
+    a->radius[dst] = a->radius[src];
+    a->class[dst]  = a->class[src];
+    a->time[dst]   = a->time[src];
+    a->px[dst]     = a->px[src];
+    a->py[dst]     = a->py[src];
+    a->w[dst]      = a->w[src];
+    a->h[dst]      = a->h[src];
+    a->angle[dst]  = a->angle[src];
+    a->cs[dst]     = a->cs[src];
+    a->sn[dst]     = a->sn[src];
+    a->seed[dst]   = a->seed[src];
+    a->shape[dst]  = a->shape[src];
+    a->id[dst]     = a->id[src];
+    a->dense[a->id[dst] & AST_SLOT_MASK] = dst;
+}
+
+/* Claims a slot for a new asteroid at the end of the live range. */
+int
+ast_alloc(Asteroids *a)
+{
+    asteroids_reserve(a, a->size + 1);
+    int i = a->size++;
+    int slot = a->free[--a->nr_free];
+    a->id[i] = (a->gen[slot] << AST_SLOT_BITS) | (Uint32)slot;
+    a->dense[slot] = i;
+    return i;
+}
+
+/* The last asteroid moves into i; its handle follows it. */
+void
+ast_remove(Asteroids *a, int i)
+{
+    shape_free(&shapes, a->shape[i]);
+    int slot = a->id[i] & AST_SLOT_MASK;
+    Uint32 gen = (a->gen[slot] + 1) & (SDL_MAX_UINT32 >> AST_SLOT_BITS);
+    a->gen[slot] = gen ? gen : 1;
+    a->free[a->nr_free++] = slot;
+    if (i != --a->size) ast_copy(a, i, a->size);
+}
+
+AstHandle
+ast_handle(const Asteroids *a, int i)
+{
+    return a->id[i];
+}
+
+/* Index of the asteroid behind h, or -1 once it has been removed. */
+int
+ast_lookup(const Asteroids *a, AstHandle h)
+{
+    Uint32 slot = h & AST_SLOT_MASK;
+    if (slot >= (Uint32)a->cap || a->gen[slot] != h >> AST_SLOT_BITS) return -1;
+    return a->dense[slot];
+}
+
+void
+ast_place(Asteroids *a, int i, float x, float y)
+{
+    a->x[i] = a->px[i] = x;
+    a->y[i] = a->py[i] = y;
+}
+
+typedef struct {
+    const Asteroids *a;
+    Uint32 now;
+    float alpha;
+    Instance *out;
+    int offset[JOB_MAX_CHUNKS];
+    int grain;
+} DrawJob;
+
+bool
+ast_visible(const Asteroids *a, int i, Uint32 now)
+{
+    return a->time[i] <= now && a->class[i] != DEAD;
+}
+
+void
+draw_count_job(void *data, int begin, int end)
+{
+    DrawJob *j = data;
+    int n = 0;
+    for(int i = begin; i < end; i++) n += ast_visible(j->a, i, j->now);
+    j->offset[begin / j->grain] = n;
+}
+
+void
+draw_write_job(void *data, int begin, int end)
+{
+    DrawJob *j = data;
+    const Asteroids *a = j->a;
+    Instance *out = &j->out[j->offset[begin / j->grain]];
+    for(int i = begin; i < end; i++) {
+        if (!ast_visible(a, i, j->now)) continue;
+        Vector2 pos = vector2_lerp_wrap((Vector2){a->px[i], a->py[i]},
+                (Vector2){a->x[i], a->y[i]}, j->alpha);
+        *out++ = (Instance){pos.x, pos.y, a->w[i], a->h[i], a->angle[i], a->shape[i]};
+    }
+}
+
+/* Instances for every visible asteroid, in index order: chunks count in
+ * parallel, a prefix sum places them, and they write in parallel. */
+void
+draw_asteroids(const Asteroids *a, Uint32 now, float alpha, Instances *in)
+{
+    static DrawJob j;
+    j = (DrawJob){.a = a, .now = now, .alpha = alpha, .grain = job_grain(a->size, JOB_GRAIN)};
+    parallel_for(draw_count_job, &j, a->size, j.grain);
+    int total = 0;
+    for(int k = 0; k * j.grain < a->size; k++) {
+        int n = j.offset[k];
+        j.offset[k] = total;
+        total += n;
+    }
+    instances_reserve(in, in->size + total);
+    j.out = &in->data[in->size];
+    parallel_for(draw_write_job, &j, a->size, j.grain);
+    in->size += total;
+}
+
+
+
+void
+min_max(float *min, float *max, float *min_vel, float *max_vel, ASTEROID_SIZE as) 
+{
+    switch (as) {
+        case BIG:
+            *min = 60.0f;
+            *min_vel = PLAYER_SPEED * 2;
+            *max_vel = PLAYER_SPEED * 3.9;
+            *max = 90.0f;
+            break;
+        case MEDIUM:
+            *min = 40.0f;
+            *min_vel = PLAYER_SPEED * 4;
+            *max_vel = PLAYER_SPEED * 6.5;
+            *max = 59.0f;
+            break;
+        case SMALL:
+            *min = 10.0f;
+            *min_vel = PLAYER_SPEED * 7;
+            *max_vel = PLAYER_SPEED * 10;
+            *max = 35.0f;
+            break;
+        case DEAD:
+            break;
+    }
+
+}
+
+/* Shortest signed distance along one axis of the torus. */
+static inline float
+torus_delta(float d, float size)
+{
+    return d - size * ((float)(d > size * 0.5f) - (float)(d < size * -0.5f));
+}
+
+/* Radius and rotation of the drawn outline; the radius is its farthest
+ * vertex once scaled by w, h. Set whenever size, angle or shape is. */
+void
+ast_bound(Asteroids *a, int i)
+{
+    a->cs[i] = SDL_cosf(a->angle[i]);
+    a->sn[i] = SDL_sinf(a->angle[i]);
+
+    const float *sx = &shapes.sx[a->shape[i] * SHAPE_STRIDE];
+    const float *sy = &shapes.sy[a->shape[i] * SHAPE_STRIDE];
+    float r2 = 0.0f;
+    for(int k = 0; k < SHAPE_STRIDE; k++) {
+        float x = sx[k] * a->w[i];
+        float y = sy[k] * a->h[i];
+        r2 = SDL_max(r2, x * x + y * y);
+    }
+    a->radius[i] = SDL_sqrtf(r2);
+}
+
+/* Exact test against the drawn outline: a bounding-radius reject, then
+ * a branchless crossing test over every edge in the shape's unit space. */
+bool
+ast_contains(const Asteroids *a, int i, float px, float py)
+{
+    float dx = torus_delta(px - a->x[i], R_WIDTH);
+    float dy = torus_delta(py - a->y[i], R_HEIGHT);
+    if (dx * dx + dy * dy >= a->radius[i] * a->radius[i]) return false;
+
+    float c = a->cs[i], s = a->sn[i];
+    float lx = (c * dx + s * dy) / a->w[i];
+    float ly = (c * dy - s * dx) / a->h[i];
+
+    const float *restrict sx = &shapes.sx[a->shape[i] * SHAPE_STRIDE];
+    const float *restrict sy = &shapes.sy[a->shape[i] * SHAPE_STRIDE];
+    int inside = 0;
+    for(int k = 0; k < SHAPE_STRIDE - 1; k++) {
+        float ax = sx[k], ay = sy[k];
+        float ey = sy[k + 1] - ay;
+        float cross = (lx - ax) * ey - (ly - ay) * (sx[k + 1] - ax);
+        int spans = (ay > ly) != (sy[k + 1] > ly);
+        inside ^= spans & ((cross < 0.0f) != (ey < 0.0f));
+    }
+    return inside;
+}
+
+/* Size and speed for the asteroid's class plus a fresh heading; the
+ * heading and speed are folded into dx/dy once here. The caller picks a
+ * shape next, which sets the radius. */
+void 
+get_rand_ast_size_vel(Asteroids *a, int i, Uint64 *rng)
+{
+    float min = 0, max = 0;
+    float min_vel = 0, max_vel = 0;
+    min_max(&min, &max, &min_vel, &max_vel, a->class[i]);
+    a->w[i] = min + SDL_randf_r(rng) * (max - min); 
+    a->h[i] = min + SDL_randf_r(rng) * (max - min);
+    float vel = min_vel + SDL_randf_r(rng) * (max_vel - min_vel);
+
+    a->angle[i] = ((SDL_randf_r(rng) * 2.0f) - 1.0f) * TAU;
+    Vector2 dir = get_direction(a->angle[i]);
+    a->dx[i] = dir.x * vel;
+    a->dy[i] = dir.y * vel;
+}
+
+void 
+get_rand_ast(Asteroids *a, int i, Uint64 *rng)
+{
+    float x = SDL_randf_r(rng) * R_WIDTH;
+    float y = SDL_randf_r(rng) * R_HEIGHT;
+    ast_place(a, i, x, y);
+    get_rand_ast_size_vel(a, i, rng); 
+    a->seed[i] = SDL_rand_bits_r(rng);
+    a->shape[i] = shape_alloc(&shapes, a->seed[i]);
+    ast_bound(a, i);
+}
+
+void
+reshape_ast(Asteroids *a, int i, Uint64 *rng)
+{
+    shape_free(&shapes, a->shape[i]);
+    a->seed[i] = SDL_rand_bits_r(rng);
+    a->shape[i] = shape_alloc(&shapes, a->seed[i]);
+    ast_bound(a, i);
+}
+
+int
+ast_spawn(Asteroids *a, ASTEROID_SIZE as, Uint32 time, Uint64 *rng)
+{
+    int i = ast_alloc(a);
+    a->class[i] = as;
+    a->time[i] = time;
+    get_rand_ast(a, i, rng);
+    return i;
+}
+
+/* x += dx * dt where time is not after now, then one compare-and-add
+ * wraps it. Every variant is bit-exact with this one. */
+NO_VECTORIZE void
+integrate_wrap_scalar(float *x, float *y, const float *dx, const float *dy,
+        const Uint32 *time, Uint32 now, float dt, int n)
+{
+    for(int i = 0; i < n; i++) {
+        float step = !time || time[i] <= now ? dt : 0.0f;
+        float nx = x[i] + dx[i] * step;
+        float ny = y[i] + dy[i] * step;
+        float ax = nx < 0.0f ? R_WIDTH : 0.0f;
+        float sx = nx >= R_WIDTH ? R_WIDTH : 0.0f;
+        float ay = ny < 0.0f ? R_HEIGHT : 0.0f;
+        float sy = ny >= R_HEIGHT ? R_HEIGHT : 0.0f;
+        x[i] = nx + ax - sx;
+        y[i] = ny + ay - sy;
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+/* SSE2 has no unsigned compare; flipping the sign bit of both sides
+ * turns time > now into a signed one. */
+__attribute__((target("sse2"))) void
+integrate_wrap_sse2(float *x, float *y, const float *dx, const float *dy,
+        const Uint32 *time, Uint32 now, float dt, int n)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 w = _mm_set1_ps(R_WIDTH);
+    const __m128 h = _mm_set1_ps(R_HEIGHT);
+    const __m128 vdt = _mm_set1_ps(dt);
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    const __m128i vnow = _mm_xor_si128(_mm_set1_epi32((int)now), bias);
+
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m128 step = vdt;
+        if (time) {
+            __m128i t = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&time[i]), bias);
+            step = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(t, vnow)), vdt);
+        }
+        __m128 nx = _mm_add_ps(_mm_loadu_ps(&x[i]), _mm_mul_ps(_mm_loadu_ps(&dx[i]), step));
+        __m128 ny = _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_mul_ps(_mm_loadu_ps(&dy[i]), step));
+        __m128 ax = _mm_and_ps(_mm_cmplt_ps(nx, zero), w);
+        __m128 sx = _mm_and_ps(_mm_cmpge_ps(nx, w), w);
+        __m128 ay = _mm_and_ps(_mm_cmplt_ps(ny, zero), h);
+        __m128 sy = _mm_and_ps(_mm_cmpge_ps(ny, h), h);
+        _mm_storeu_ps(&x[i], _mm_sub_ps(_mm_add_ps(nx, ax), sx));
+        _mm_storeu_ps(&y[i], _mm_sub_ps(_mm_add_ps(ny, ay), sy));
+    }
+    integrate_wrap_scalar(x + i, y + i, dx + i, dy + i, time ? time + i : NULL,
+            now, dt, n - i);
+}
+
+__attribute__((target("avx2"))) void
+integrate_wrap_avx2(float *x, float *y, const float *dx, const float *dy,
+        const Uint32 *time, Uint32 now, float dt, int n)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 w = _mm256_set1_ps(R_WIDTH);
+    const __m256 h = _mm256_set1_ps(R_HEIGHT);
+    const __m256 vdt = _mm256_set1_ps(dt);
+    const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+    const __m256i vnow = _mm256_xor_si256(_mm256_set1_epi32((int)now), bias);
+
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256 step = vdt;
+        if (time) {
+            __m256i t = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&time[i]), bias);
+            step = _mm256_andnot_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(t, vnow)), vdt);
+        }
+        __m256 nx = _mm256_add_ps(_mm256_loadu_ps(&x[i]), _mm256_mul_ps(_mm256_loadu_ps(&dx[i]), step));
+        __m256 ny = _mm256_add_ps(_mm256_loadu_ps(&y[i]), _mm256_mul_ps(_mm256_loadu_ps(&dy[i]), step));
+        __m256 ax = _mm256_and_ps(_mm256_cmp_ps(nx, zero, _CMP_LT_OQ), w);
+        __m256 sx = _mm256_and_ps(_mm256_cmp_ps(nx, w, _CMP_GE_OQ), w);
+        __m256 ay = _mm256_and_ps(_mm256_cmp_ps(ny, zero, _CMP_LT_OQ), h);
+        __m256 sy = _mm256_and_ps(_mm256_cmp_ps(ny, h, _CMP_GE_OQ), h);
+        _mm256_storeu_ps(&x[i], _mm256_sub_ps(_mm256_add_ps(nx, ax), sx));
+        _mm256_storeu_ps(&y[i], _mm256_sub_ps(_mm256_add_ps(ny, ay), sy));
+    }
+    integrate_wrap_sse2(x + i, y + i, dx + i, dy + i, time ? time + i : NULL,
+            now, dt, n - i);
+}
+#endif
+
+static const Kernel kernels[] = {
+    { "scalar", integrate_wrap_scalar, NULL },
+#ifdef HAVE_X86_KERNELS
+    { "sse2",   integrate_wrap_sse2,   SDL_HasSSE2 },
+    { "avx2",   integrate_wrap_avx2,   SDL_HasAVX2 },
+#endif
+};
+
+IntegrateWrap integrate_wrap = integrate_wrap_scalar;
+
+/* Picks the widest variant CPUID reports as usable. */
+void
+kernels_init(void)
+{
+    const char *name = kernels[0].name;
+    for(size_t i = 0; i < SDL_arraysize(kernels); i++) {
+        if (kernels[i].supported && !kernels[i].supported()) continue;
+        integrate_wrap = kernels[i].fn;
+        name = kernels[i].name;
+    }
+    SDL_Log("integrate_wrap: %s\n", name);
+}
+
+typedef struct {
+    float *x, *y;
+    const float *dx, *dy;
+    const Uint32 *time;
+    Uint32 now;
+    float dt;
+} IntegrateJob;
+
+void
+integrate_job(void *data, int begin, int end)
+{
+    IntegrateJob *j = data;
+    integrate_wrap(j->x + begin, j->y + begin, j->dx + begin, j->dy + begin,
+            j->time ? j->time + begin : NULL, j->now, j->dt, end - begin);
+}
+
+/* integrate_wrap() over all threads; entries are independent, so the
+ * result is the same bits as one call. */
+void
+integrate_parallel(float *x, float *y, const float *dx, const float *dy,
+        const Uint32 *time, Uint32 now, float dt, int n)
+{
+    IntegrateJob j = {x, y, dx, dy, time, now, dt};
+    parallel_for(integrate_job, &j, n, job_grain(n, JOB_GRAIN));
+}
+
+void
+asteroids_integrate(Asteroids *a, float dt, Uint32 now)
+{
+    integrate_parallel(a->x, a->y, a->dx, a->dy, a->time, now, dt, a->size);
+}
+
+/* First live asteroid whose outline contains (px, py), or -1. The
+ * linear reference for grid_hit(). */
+int
+asteroids_hit(const Asteroids *a, float px, float py, Uint32 now)
+{
+    const float *restrict x = a->x;
+    const float *restrict y = a->y;
+    const float *restrict radius = a->radius;
+    const Uint32 *restrict time = a->time;
+
+    for(int base = 0; base < a->size; base += AST_BLOCK) {
+        int end = SDL_min(base + AST_BLOCK, a->size);
+        int any = 0;
+        for(int i = base; i < end; i++) {
+            float ddx = torus_delta(x[i] - px, R_WIDTH);
+            float ddy = torus_delta(y[i] - py, R_HEIGHT);
+            any |= (ddx * ddx + ddy * ddy < radius[i] * radius[i]) & (time[i] <= now);
+        }
+        if (!any) continue;
+
+        for(int i = base; i < end; i++) {
+            if (time[i] <= now && ast_contains(a, i, px, py)) return i;
+        }
+    }
+    return -1;
+}
+
+void
+grid_init(Grid *g, float cell)
+{
+    *g = (Grid){0};
+    g->cols = SDL_max((int)(R_WIDTH / cell), 1);
+    g->rows = SDL_max((int)(R_HEIGHT / cell), 1);
+    g->cell_w = R_WIDTH / g->cols;
+    g->cell_h = R_HEIGHT / g->rows;
+    g->start = SDL_calloc(g->cols * g->rows + 1, sizeof(int));
+}
+
+void
+grid_destroy(Grid *g)
+{
+    SDL_free(g->start);
+    SDL_free(g->items);
+    SDL_free(g->cell);
+    SDL_free(g->hist);
+    *g = (Grid){0};
+}
+
+int
+grid_cell(const Grid *g, float x, float y)
+{
+    int cx = SDL_clamp((int)(x / g->cell_w), 0, g->cols - 1);
+    int cy = SDL_clamp((int)(y / g->cell_h), 0, g->rows - 1);
+    return cy * g->cols + cx;
+}
+
+typedef struct {
+    Grid *g;
+    const Asteroids *a;
+    Uint32 now;
+    int grain;
+} GridJob;
+
+void
+grid_count_job(void *data, int begin, int end)
+{
+    GridJob *j = data;
+    Grid *g = j->g;
+    const Asteroids *a = j->a;
+    int cells = g->cols * g->rows;
+    int *hist = &g->hist[begin / j->grain * cells];
+
+    SDL_memset(hist, 0, cells * sizeof(int));
+    for(int i = begin; i < end; i++) {
+        g->cell[i] = a->time[i] <= j->now ? grid_cell(g, a->x[i], a->y[i]) : -1;
+        if (g->cell[i] >= 0) hist[g->cell[i]]++;
+    }
+}
+
+void
+grid_scatter_job(void *data, int begin, int end)
+{
+    GridJob *j = data;
+    Grid *g = j->g;
+    int *cursor = &g->hist[begin / j->grain * (g->cols * g->rows)];
+    for(int i = begin; i < end; i++) {
+        if (g->cell[i] >= 0) g->items[cursor[g->cell[i]]++] = i;
+    }
+}
+
+/* Counting sort of the live, unfrozen asteroids by cell, in parallel
+ * chunks; items stay ascending within each cell, as in a serial build. */
+void
+grid_build(Grid *g, const Asteroids *a, Uint32 now)
+{
+    int cells = g->cols * g->rows;
+    int n = a->size;
+    if (n > g->cap) {
+        g->cap = a->cap;
+        g->items = SDL_realloc(g->items, g->cap * sizeof(int));
+        g->cell = SDL_realloc(g->cell, g->cap * sizeof(int));
+    }
+    GridJob j = {g, a, now, job_grain(n, JOB_GRAIN)};
+    int chunks = (n + j.grain - 1) / j.grain;
+    if (chunks * cells > g->hist_cap) {
+        g->hist_cap = chunks * cells;
+        g->hist = SDL_realloc(g->hist, g->hist_cap * sizeof(int));
+    }
+
+    parallel_for(grid_count_job, &j, n, j.grain);
+    int total = 0;
+    for(int c = 0; c < cells; c++) {
+        g->start[c] = total;
+        for(int k = 0; k < chunks; k++) {
+            int count = g->hist[k * cells + c];
+            g->hist[k * cells + c] = total;
+            total += count;
+        }
+    }
+    g->start[cells] = total;
+    parallel_for(grid_scatter_job, &j, n, j.grain);
+    g->size = total;
+}
+
+/* Same answer as asteroids_hit(). The point's own cell goes first: an
+ * early low best cuts the scan of every neighbour short. */
+int
+grid_hit(const Grid *g, const Asteroids *a, float px, float py, Uint32 now)
+{
+    static const int order[3] = {0, -1, 1};
+    int c = grid_cell(g, px, py);
+    int cx = c % g->cols, cy = c / g->cols;
+    int best = -1;
+
+    for(int y = 0; y < 3; y++) {
+        int row = (cy + order[y] + g->rows) % g->rows;
+        for(int x = 0; x < 3; x++) {
+            int cell = row * g->cols + (cx + order[x] + g->cols) % g->cols;
+            for(int k = g->start[cell]; k < g->start[cell + 1]; k++) {
+                int i = g->items[k];
+                if (best >= 0 && i >= best) break;
+                if (a->time[i] <= now && ast_contains(a, i, px, py)) best = i;
+            }
+        }
+    }
+    return best;
+}
+
+bool collision(Vector2 *pos1, Vector2 *pos2, Vector2 *size) {
+    if(SDL_sqrtf((pos1->x - pos2->x) * (pos1->x - pos2->x) + 
+                (pos1->y - pos2->y) * (pos1->y - pos2->y)) < (size->x / 2)) {
+        return true;
+
+    }
+    if(SDL_sqrtf((pos1->x - pos2->x) * (pos1->x - pos2->x) + 
+                (pos1->y - pos2->y) * (pos1->y - pos2->y)) < (size->y / 2)) {
+        return true;
+
+    }
+    return false;
+}
+
+/* Splits or kills asteroid i. Pieces stay frozen (and hidden) for 1.3 s
+ * through their time stamp. */
+void
+ast_hit(Asteroids *a, int i, Uint32 now, Uint64 *rng)
+{
+    Uint32 tick = now + 1300;
+    switch (a->class[i]) {
+        case BIG:
+        case MEDIUM: {
+            ASTEROID_SIZE as = a->class[i];
+            ASTEROID_SIZE next = as == BIG ? MEDIUM : SMALL;
+            a->class[i] = next;
+            get_rand_ast_size_vel(a, i, rng);
+            reshape_ast(a, i, rng);
+            a->time[i] = tick;
+
+            int c = ast_spawn(a, next, tick, rng);
+            ast_place(a, c, a->x[i], a->y[i] + a->h[i]);
+            if (as == BIG) {
+                int d = ast_spawn(a, next, tick, rng);
+                ast_place(a, d, a->x[c] + a->w[c], a->y[c] + (a->h[c] / 2));
+            }
+            break;
+        }
+        case SMALL:
+            a->time[i] = tick;
+            a->class[i] = DEAD;
+            break;
+        case DEAD:
+            break;
+    }
+}
+
+void
+particles_init(Particles *p, int cap)
+{
+    *p = (Particles){.cap = cap};
+    void **arrays[] = {
+        (void **)&p->x, (void **)&p->y, (void **)&p->px, (void **)&p->py,
+        (void **)&p->dx, (void **)&p->dy, (void **)&p->expire
+    };
+    for(size_t i = 0; i < SDL_arraysize(arrays); i++) {
+        *arrays[i] = SDL_aligned_alloc(AST_ALIGN, cap * sizeof(float));
+        if (!*arrays[i]) {
+            ERROR_EXIT(1, "Out of memory for %d particles\n", cap);
+        }
+    }
+    for(int i = 0; i < PARTICLE_DIRS; i++) {
+        p->dir_x[i] = SDL_cosf(i * TAU / PARTICLE_DIRS);
+        p->dir_y[i] = SDL_sinf(i * TAU / PARTICLE_DIRS);
+    }
+}
+
+void
+particles_destroy(Particles *p)
+{
+    void *arrays[] = {p->x, p->y, p->px, p->py, p->dx, p->dy, p->expire};
+    for(size_t i = 0; i < SDL_arraysize(arrays); i++) {
+        SDL_aligned_free(arrays[i]);
+    }
+    SDL_free(p->queue);
+    SDL_free(p->tick_end);
+    *p = (Particles){0};
+}
+
+/* False when all MAX_EMITTERS are busy; the effect is skipped. */
+bool
+particles_emit(Particles *p, Emitter e)
+{
+    if (p->nr_emitters == MAX_EMITTERS) return false;
+    p->emitter[p->nr_emitters++] = e;
+    return true;
+}
+
+/* Moves each following emitter onto its asteroid, drifting at half its
+ * speed once the piece thaws. The asteroid's index changes whenever an
+ * earlier one is removed; the handle does not. */
+void
+particles_follow(Particles *p, const Asteroids *a, Uint32 now)
+{
+    for(int k = 0; k < p->nr_emitters; k++) {
+        Emitter *e = &p->emitter[k];
+        if (e->follow == AST_NONE) continue;
+        int i = ast_lookup(a, e->follow);
+        if (i < 0) {
+            *e = p->emitter[--p->nr_emitters];
+            k--;
+            continue;
+        }
+        bool frozen = a->time[i] > now;
+        e->x = a->x[i];
+        e->y = a->y[i];
+        e->dx = frozen ? 0.0f : a->dx[i] * 0.5f;
+        e->dy = frozen ? 0.0f : a->dy[i] * 0.5f;
+    }
+}
+
+/* One tick: spawn from every emitter (retiring the finished ones), drop
+ * what expired, then move the rest. Dropped particles still take their
+ * random draws, so the RNG stream is the same whichever backend runs. */
+void
+particles_tick(Particles *p, float dt, Uint32 now, Uint64 *rng)
+{
+    for(int k = 0; k < p->nr_emitters; k++) {
+        Emitter *e = &p->emitter[k];
+        if (p->deferred && p->nr_queue + e->rate > p->cap_queue) {
+            p->cap_queue = SDL_max(p->cap_queue * 2, p->nr_queue + e->rate);
+            p->queue = SDL_realloc(p->queue, p->cap_queue * sizeof(Spawn));
+        }
+        for(int n = 0; n < e->rate; n++) {
+            int dir = SDL_rand_r(rng, PARTICLE_DIRS);
+            float speed = e->speed * SDL_randf_r(rng);
+            Spawn sp = {e->x, e->y, e->dx + speed * p->dir_x[dir],
+                e->dy + speed * p->dir_y[dir],
+                now + e->life / 2 + SDL_rand_r(rng, e->life / 2 + 1)};
+            if (p->deferred) {
+                p->queue[p->nr_queue++] = sp;
+            } else if (p->size < p->cap) {
+                int i = p->size++;
+                p->x[i] = sp.x;
+                p->y[i] = sp.y;
+                p->dx[i] = sp.dx;
+                p->dy[i] = sp.dy;
+                p->expire[i] = sp.expire;
+            } else {
+                p->dropped++;
+            }
+        }
+        p->spawned += e->rate;
+        if (e->until <= now) {
+            *e = p->emitter[--p->nr_emitters];
+            k--;
+        }
+    }
+
+    if (p->deferred) {
+        if (p->nr_ticks == p->cap_ticks) {
+            p->cap_ticks = SDL_max(p->cap_ticks * 2, 16);
+            p->tick_end = SDL_realloc(p->tick_end, p->cap_ticks * sizeof(int));
+        }
+        p->tick_end[p->nr_ticks++] = p->nr_queue;
+        return;
+    }
+
+    int w = 0;
+    for(int i = 0; i < p->size; i++) {
+        p->x[w] = p->x[i];
+        p->y[w] = p->y[i];
+        p->dx[w] = p->dx[i];
+        p->dy[w] = p->dy[i];
+        p->expire[w] = p->expire[i];
+        w += p->expire[i] > now;
+    }
+    p->size = w;
+
+    SDL_memcpy(p->px, p->x, p->size * sizeof(float));
+    SDL_memcpy(p->py, p->y, p->size * sizeof(float));
+    integrate_parallel(p->x, p->y, p->dx, p->dy, NULL, now, dt, p->size);
+}
+
+/* Every live particle into one points batch, interpolated like the rest
+ * of the frame. This is vector2_lerp_wrap spelled out without calls so
+ * the loop stays branch free. */
+void
+particles_draw(const Particles *p, float alpha, Batch *b)
+{
+    batch_reserve(b, b->nr_v + p->size);
+    float *v = &b->vert[b->nr_v * 3];
+    for(int i = 0; i < p->size; i++) {
+        float ex = p->x[i] - p->px[i];
+        float ey = p->y[i] - p->py[i];
+        bool snap = ex > R_WIDTH * 0.5f || ex < -R_WIDTH * 0.5f ||
+            ey > R_HEIGHT * 0.5f || ey < -R_HEIGHT * 0.5f;
+        float t = snap ? 1.0f : alpha;
+        v[i * 3] = p->px[i] + ex * t;
+        v[i * 3 + 1] = p->py[i] + ey * t;
+        v[i * 3 + 2] = 0.0f;
+    }
+    b->nr_v += p->size;
+}
+
+void
+gpu_particles_init(GpuParticles *gp, int cap)
+{
+    *gp = (GpuParticles){.cap = cap};
+    gp->step = &pipelines[PIPE_PARTICLE_STEP];
+    gp->draw = &pipelines[PIPE_PARTICLES];
+    gp->expire = SDL_malloc(cap * sizeof(Uint32));
+    int *attrib = gp->draw->attrib;
+
+    glGenBuffers(2, gp->vbo);
+    glGenVertexArrays(2, gp->vao);
+    for(int i = 0; i < 2; i++) {
+        gl_bind_array_buffer(gp->vbo[i]);
+        glBufferData(GL_ARRAY_BUFFER, cap * sizeof(Spawn), NULL, GL_DYNAMIC_COPY);
+        gl_bind_vao(gp->vao[i]);
+        glEnableVertexAttribArray(attrib[A_POS]);
+        glEnableVertexAttribArray(attrib[A_VEL]);
+        glEnableVertexAttribArray(attrib[A_EXPIRE]);
+        glVertexAttribPointer(attrib[A_POS], 2, GL_FLOAT, GL_FALSE, sizeof(Spawn),
+                (void *)offsetof(Spawn, x));
+        glVertexAttribPointer(attrib[A_VEL], 2, GL_FLOAT, GL_FALSE, sizeof(Spawn),
+                (void *)offsetof(Spawn, dx));
+        glVertexAttribIPointer(attrib[A_EXPIRE], 1, GL_UNSIGNED_INT, sizeof(Spawn),
+                (void *)offsetof(Spawn, expire));
+    }
+    /* Headless runs skip the per-pipeline uniforms in main. */
+    gl_use_program(gp->step->program);
+    glUniform2f(gp->step->uniform[U_WORLD], R_WIDTH, R_HEIGHT);
+}
+
+void
+gpu_particles_destroy(GpuParticles *gp)
+{
+    glDeleteVertexArrays(2, gp->vao);
+    glDeleteBuffers(2, gp->vbo);
+    SDL_free(gp->expire);
+    *gp = (GpuParticles){0};
+}
+
+/* Writes n spawns into the ring at head, overwriting the oldest slots. */
+void
+gpu_particles_upload(GpuParticles *gp, const Spawn *data, int n)
+{
+    gl_bind_array_buffer(gp->vbo[gp->src]);
+    while(n > 0) {
+        int run = SDL_min(n, gp->cap - gp->head);
+        glBufferSubData(GL_ARRAY_BUFFER, gp->head * sizeof(Spawn), run * sizeof(Spawn), data);
+        gl_count(1);
+        for(int i = 0; i < run; i++) {
+            gp->expire[gp->head + i] = data[i].expire;
+        }
+        gp->head = (gp->head + run) % gp->cap;
+        gp->count = SDL_min(gp->count + run, gp->cap);
+        gp->bytes += run * sizeof(Spawn);
+        data += run;
+        n -= run;
+    }
+}
+
+/* Drops the oldest records while they are expired; a ring that drains
+ * starts over at slot 0 so the live extent stays in one run. */
+void
+gpu_particles_trim(GpuParticles *gp, Uint32 now)
+{
+    while(gp->count > 0 && gp->expire[(gp->head - gp->count + gp->cap) % gp->cap] <= now) {
+        gp->count--;
+    }
+    if (gp->count == 0) gp->head = 0;
+}
+
+/* The live extent as at most two runs of slots, oldest first. */
+int
+gpu_particles_runs(const GpuParticles *gp, int first[2], int n[2])
+{
+    first[0] = (gp->head - gp->count + gp->cap) % gp->cap;
+    n[0] = SDL_min(gp->count, gp->cap - first[0]);
+    first[1] = 0;
+    n[1] = gp->count - n[0];
+    return n[1] > 0 ? 2 : 1;
+}
+
+/* Feedback writes from the start of the bound range, so each run binds
+ * its own slots of the other buffer. */
+void
+gpu_particles_step(GpuParticles *gp, float dt)
+{
+    if (gp->count == 0) return;
+    int first[2], n[2];
+    int runs = gpu_particles_runs(gp, first, n);
+    gl_use_program(gp->step->program);
+    glUniform1f(gp->step->uniform[U_DT], dt);
+    gl_bind_vao(gp->vao[gp->src]);
+    glEnable(GL_RASTERIZER_DISCARD);
+    for(int r = 0; r < runs; r++) {
+        glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, gp->vbo[gp->src ^ 1],
+                first[r] * sizeof(Spawn), n[r] * sizeof(Spawn));
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, first[r], n[r]);
+        glEndTransformFeedback();
+        gl_count(4);
+    }
+    glDisable(GL_RASTERIZER_DISCARD);
+    gl_count(3);
+    gp->src ^= 1;
+    gp->steps++;
+    gp->stepped += gp->count;
+}
+
+/* Replays the ticks the sim ran since the last frame: each one uploads
+ * its spawns and then steps, the order particles_tick uses on the CPU.
+ * Whatever is dead by now is trimmed first and never stepped again. */
+void
+gpu_particles_update(GpuParticles *gp, Particles *p, float dt, Uint32 now)
+{
+    gpu_particles_trim(gp, now);
+    int start = 0;
+    for(int k = 0; k < p->nr_ticks; k++) {
+        gpu_particles_upload(gp, &p->queue[start], p->tick_end[k] - start);
+        gpu_particles_step(gp, dt);
+        start = p->tick_end[k];
+    }
+    p->nr_queue = 0;
+    p->nr_ticks = 0;
+}
+
+void
+gpu_particles_draw(GpuParticles *gp, Uint32 now, float dt, float alpha)
+{
+    if (gp->count == 0) return;
+    gl.draws++;
+    gl.vertices += gp->count;
+    if (headless) return;
+    int first[2], n[2];
+    int runs = gpu_particles_runs(gp, first, n);
+    gl_use_program(gp->draw->program);
+    glUniform1ui(gp->draw->uniform[U_NOW], now);
+    glUniform1f(gp->draw->uniform[U_DT], dt);
+    glUniform1f(gp->draw->uniform[U_ALPHA], alpha);
+    gl_bind_vao(gp->vao[gp->src]);
+    for(int r = 0; r < runs; r++) {
+        glDrawArrays(GL_POINTS, first[r], n[r]);
+    }
+    gl_count(3 + runs);
+}
+
+/* Reads the live records back in ring order, oldest first; returns how
+ * many went into out. */
+int
+gpu_particles_read(GpuParticles *gp, Spawn *out)
+{
+    int first[2], n[2];
+    int runs = gpu_particles_runs(gp, first, n);
+    int nr = 0;
+    gl_bind_array_buffer(gp->vbo[gp->src]);
+    for(int r = 0; r < runs; r++) {
+        glGetBufferSubData(GL_ARRAY_BUFFER, first[r] * sizeof(Spawn), n[r] * sizeof(Spawn),
+                &out[nr]);
+        nr += n[r];
+    }
+    return nr;
+}
+
+void
+bullets_init(Bullets *b, int cap, BULLET_POLICY policy)
+{
+    *b = (Bullets){0};
+    b->cap = cap;
+    b->policy = policy;
+    void **arrays[] = {
+        (void **)&b->x, (void **)&b->y, (void **)&b->px, (void **)&b->py,
+        (void **)&b->dx, (void **)&b->dy, (void **)&b->expire, (void **)&b->hit
+    };
+    for(size_t i = 0; i < SDL_arraysize(arrays); i++) {
+        *arrays[i] = SDL_aligned_alloc(AST_ALIGN, cap * sizeof(float));
+        if (!*arrays[i]) {
+            ERROR_EXIT(1, "Out of memory for %d bullets\n", cap);
+        }
+    }
+}
+
+void
+bullets_destroy(Bullets *b)
+{
+    void *arrays[] = {b->x, b->y, b->px, b->py, b->dx, b->dy, b->expire, b->hit};
+    for(size_t i = 0; i < SDL_arraysize(arrays); i++) {
+        SDL_aligned_free(arrays[i]);
+    }
+    *b = (Bullets){0};
+}
+
+void
+bullets_move(Bullets *b, int dst, int src, int n)
+{
+    SDL_memmove(&b->x[dst],      &b->x[src],      n * sizeof(float));
+    SDL_memmove(&b->y[dst],      &b->y[src],      n * sizeof(float));
+    SDL_memmove(&b->px[dst],     &b->px[src],     n * sizeof(float));
+    SDL_memmove(&b->py[dst],     &b->py[src],     n * sizeof(float));
+    SDL_memmove(&b->dx[dst],     &b->dx[src],     n * sizeof(float));
+    SDL_memmove(&b->dy[dst],     &b->dy[src],     n * sizeof(float));
+    SDL_memmove(&b->expire[dst], &b->expire[src], n * sizeof(Uint32));
+}
+
+/* Index of the new bullet, or -1 when the pool is full and keeps what it
+ * has. The live range slides back to 0 only when it reaches the end. */
+int
+bullets_spawn(Bullets *b, Vector2 pos, Vector2 vel, Uint32 now)
+{
+    b->fired++;
+    if (b->size == b->cap) {
+        b->dropped++;
+        if (b->policy == BULLET_DROP_NEW) return -1;
+        b->head++;
+        b->size--;
+    }
+    if (b->head + b->size == b->cap) {
+        bullets_move(b, 0, b->head, b->size);
+        b->head = 0;
+    }
+    int i = b->head + b->size++;
+    b->x[i] = b->px[i] = pos.x;
+    b->y[i] = b->py[i] = pos.y;
+    b->dx[i] = vel.x;
+    b->dy[i] = vel.y;
+    b->expire[i] = now + BULLET_LIFE;
+    return i;
+}
+
+/* Drops the prefix that expired before now, found by binary search. */
+void
+bullets_expire(Bullets *b, Uint32 now)
+{
+    int lo = b->head, hi = b->head + b->size;
+    while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (b->expire[mid] < now) lo = mid + 1;
+        else hi = mid;
+    }
+    b->expired += lo - b->head;
+    b->size -= lo - b->head;
+    b->head = lo;
+}
+
+typedef struct {
+    Bullets *b;
+    const Asteroids *a;
+    const Grid *grid;
+    Uint32 now;
+} QueryJob;
+
+void
+bullets_query_job(void *data, int begin, int end)
+{
+    QueryJob *j = data;
+    Bullets *b = j->b;
+    for(int i = b->head + begin; i < b->head + end; i++) {
+        b->hit[i] = grid_hit(j->grid, j->a, b->x[i], b->y[i], j->now);
+    }
+}
+
+/* Lookups run in parallel, hits apply in bullet order; a target frozen
+ * earlier this tick is looked up again, so the result is the serial one. */
+void
+bullets_collide(Bullets *b, Asteroids *a, const Grid *grid, Uint32 now, Uint64 *rng,
+        Particles *fx)
+{
+    prof_begin(&prof, P_COLLISION);
+    QueryJob j = {b, a, grid, now};
+    parallel_for(bullets_query_job, &j, b->size, job_grain(b->size, JOB_GRAIN / 16));
+
+    int w = 0;
+    for(int i = b->head; i < b->head + b->size; i++) {
+        int t = b->hit[i];
+        if (t >= 0 && a->time[t] > now) t = grid_hit(grid, a, b->x[i], b->y[i], now);
+        if (t >= 0) {
+            if (fx) {
+                particles_emit(fx, (Emitter){b->x[i], b->y[i], a->dx[t] * 0.5f,
+                        a->dy[t] * 0.5f, 90.0f, 6, now + 50, 900, AST_NONE});
+                particles_emit(fx, (Emitter){a->x[t], a->y[t], 0.0f, 0.0f,
+                        25.0f, 1, now + 2500, 700, ast_handle(a, t)});
+            }
+            ast_hit(a, t, now, rng);
+            continue;
+        }
+        if (w != i) {
+            b->x[w] = b->x[i];
+            b->y[w] = b->y[i];
+            b->px[w] = b->px[i];
+            b->py[w] = b->py[i];
+            b->dx[w] = b->dx[i];
+            b->dy[w] = b->dy[i];
+            b->expire[w] = b->expire[i];
+        }
+        w++;
+    }
+    b->hits += b->size - w;
+    b->head = 0;
+    b->size = w;
+    prof_end(&prof, P_COLLISION);
+}
+
+void
+bullets_integrate(Bullets *b, float dt, Uint32 now)
+{
+    integrate_parallel(&b->x[b->head], &b->y[b->head], &b->dx[b->head], &b->dy[b->head],
+            NULL, now, dt, b->size);
+}
+
+void
+game_init(Game *g, int hz, Uint64 seed)
+{
+    SDL_memset(g, 0, sizeof(*g));
+    g->hz = hz;
+    g->dt = 1.0f / (float)hz;
+    g->seed = seed;
+    for(int i = 0; i < RNG_COUNT; i++) {
+        g->rng[i] = rng_seed(seed, i);
+    }
+
+    asteroids_init(&g->ast, MAX_ASTEROIDS * 2);
+    grid_init(&g->grid, GRID_CELL);
+    bullets_init(&g->b, BULLET_CAP, BULLET_DROP_OLDEST);
+    particles_init(&g->fx, PARTICLE_CAP);
+    for(int i = 0; i < MAX_ASTEROIDS; i++){
+        ast_spawn(&g->ast, SDL_rand_r(&g->rng[RNG_SPAWN], 3), 0, &g->rng[RNG_SPAWN]);
+    }
+
+    Player *p = &g->p;
+    p->pos.x = R_WIDTH / 2;
+    p->pos.y = R_HEIGHT / 2;
+    p->size.x = PSIZE;
+    p->size.y = PSIZE;
+    p->life = 3;
+    p->angle = 0.0f;
+    p->vel.x = .0f;
+    p->vel.y = .0f;
+    p->dir = get_direction(p->angle);
+    g->prev_pos = p->pos;
+}
+
+/* Chains the state that decides the next tick into the last checksum.
+ * A serial pass, so only recording, replay and --bench call it. */
+Uint64
+game_checksum(const Game *g)
+{
+    const Player *p = &g->p;
+    const Asteroids *a = &g->ast;
+    const Bullets *b = &g->b;
+    Uint64 h = g->checksum;
+
+    h = hash_bytes(h, &g->ticks, sizeof(g->ticks));
+    h = hash_bytes(h, g->rng, sizeof(g->rng));
+    h = hash_bytes(h, &p->pos, sizeof(p->pos));
+    h = hash_bytes(h, &p->vel, sizeof(p->vel));
+    h = hash_bytes(h, &p->angle, sizeof(p->angle));
+    h = hash_bytes(h, &p->life, sizeof(p->life));
+    h = hash_bytes(h, &g->dead, sizeof(g->dead));
+    h = hash_bytes(h, &g->dtime, sizeof(g->dtime));
+
+    h = hash_bytes(h, &a->size, sizeof(a->size));
+    h = hash_bytes(h, a->x, a->size * sizeof(float));
+    h = hash_bytes(h, a->y, a->size * sizeof(float));
+    h = hash_bytes(h, a->dx, a->size * sizeof(float));
+    h = hash_bytes(h, a->dy, a->size * sizeof(float));
+    h = hash_bytes(h, a->w, a->size * sizeof(float));
+    h = hash_bytes(h, a->h, a->size * sizeof(float));
+    h = hash_bytes(h, a->class, a->size * sizeof(Uint8));
+    h = hash_bytes(h, a->time, a->size * sizeof(Uint32));
+    h = hash_bytes(h, a->seed, a->size * sizeof(int));
+
+    h = hash_bytes(h, &b->size, sizeof(b->size));
+    h = hash_bytes(h, &b->x[b->head], b->size * sizeof(float));
+    h = hash_bytes(h, &b->y[b->head], b->size * sizeof(float));
+    h = hash_bytes(h, &b->expire[b->head], b->size * sizeof(Uint32));
+    h = hash_bytes(h, &g->fx.spawned, sizeof(g->fx.spawned));
+    h = hash_bytes(h, &g->fx.nr_emitters, sizeof(g->fx.nr_emitters));
+    return h;
+}
+
+void
+game_destroy(Game *g)
+{
+    particles_destroy(&g->fx);
+    bullets_destroy(&g->b);
+    grid_destroy(&g->grid);
+    while(g->ast.size) ast_remove(&g->ast, g->ast.size - 1);
+    asteroids_destroy(&g->ast);
+}
+
+/* Swaps the starting field for the stress one; called right after
+ * game_init, so the spawns still come from RNG_SPAWN. */
+void
+game_stress(Game *g, const Stress *st)
+{
+    Asteroids *a = &g->ast;
+    Uint64 *rng = &g->rng[RNG_SPAWN];
+    g->stress = *st;
+
+    while(a->size) ast_remove(a, a->size - 1);
+    asteroids_reserve(a, st->asteroids);
+    shape_cache_reserve(&shapes, st->asteroids);
+    int total = st->mix[BIG] + st->mix[MEDIUM] + st->mix[SMALL];
+    for(int i = 0; i < st->asteroids; i++) {
+        int r = SDL_rand_r(rng, total);
+        ASTEROID_SIZE as = r < st->mix[BIG] ? BIG :
+            r < st->mix[BIG] + st->mix[MEDIUM] ? MEDIUM : SMALL;
+        ast_spawn(a, as, 0, rng);
+    }
+
+    if (st->bullets > g->b.cap) {
+        bullets_destroy(&g->b);
+        bullets_init(&g->b, st->bullets, BULLET_DROP_OLDEST);
+    }
+}
+
+/* Tops the bullets back up to stress.bullets, each turned from the last
+ * by the golden angle so the stream covers every heading evenly. */
+void
+stress_fire(Game *g, Uint32 now)
+{
+    Player *p = &g->p;
+    for(int n = g->stress.bullets - g->b.size; n > 0; n--) {
+        g->fire_angle += 2.39996323f;
+        if (g->fire_angle >= TAU) g->fire_angle -= TAU;
+        Vector2 dir = get_direction(g->fire_angle);
+        bullets_spawn(&g->b, p->pos, vector2_scale(&dir, BULLET_SPEED), now);
+    }
+}
+
+/* Hits every live asteroid in one tick, the worst case for the split
+ * path. Pieces land past the old end and are left alone. A BIG adds two,
+ * a MEDIUM one and a SMALL none, so that is all the room reserved. */
+void
+stress_cascade(Game *g, Uint32 now)
+{
+    Asteroids *a = &g->ast;
+    int n = a->size;
+    Uint64 start = SDL_GetPerformanceCounter();
+    int pieces = 0;
+    for(int i = 0; i < n; i++) {
+        if (a->time[i] > now) continue;
+        pieces += a->class[i] == BIG ? 2 : a->class[i] == MEDIUM;
+    }
+    asteroids_reserve(a, n + pieces);
+    shape_cache_reserve(&shapes, pieces);
+    for(int i = 0; i < n; i++) {
+        if (a->time[i] <= now && a->class[i] != DEAD) ast_hit(a, i, now, &g->rng[RNG_SPLIT]);
+    }
+    double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 /
+        (double)SDL_GetPerformanceFrequency();
+    SDL_Log("stress: cascade at tick %llu split %d asteroids into %d in %.2f ms\n",
+            (unsigned long long)g->ticks, n, a->size, ms);
+}
+
+/* One fixed step of g->dt seconds. The ship's drag and velocity were
+ * tuned as per-frame constants at 60 Hz, so they are rescaled by
+ * k = dt * 60 to behave the same at any tick rate. */
+void
+game_tick(Game *g, Input *in)
+{
+    Player *p = &g->p;
+    Bullets *b = &g->b;
+    Asteroids *a = &g->ast;
+    float dt = g->dt;
+    float k = dt * 60.0f;
+
+    g->ticks++;
+    g->time = (Uint32)(g->ticks * 1000 / g->hz);
+    Uint32 now = g->time;
+
+    g->prev_pos = p->pos;
+    g->prev_angle = p->angle;
+    SDL_memcpy(a->px, a->x, a->size * sizeof(float));
+    SDL_memcpy(a->py, a->y, a->size * sizeof(float));
+    SDL_memcpy(&b->px[b->head], &b->x[b->head], b->size * sizeof(float));
+    SDL_memcpy(&b->py[b->head], &b->y[b->head], b->size * sizeof(float));
+
+    prof_begin(&prof, P_PLAYER);
+    for(; in->fire > 0; in->fire--) {
+        if(g->dead) continue;
+        Vector2 t = vector2_add(p->pos, vector2_scale(&p->dir, PSIZE / 2.0f));
+        bullets_spawn(b, t, vector2_scale(&p->dir, BULLET_SPEED), now);
+    }
+    if(g->stress.bullets) stress_fire(g, now);
+
+    g->thrust = in->thrust && !g->dead;
+    if(g->thrust) {
+        p->vel = vector2_add(p->vel,
+                vector2_scale(&p->dir, dt * PLAYER_SPEED));
+    }
+
+    if(in->left && !g->dead) {
+        p->angle -= dt * (PI * 2.0f) * 1.5f;
+        p->dir = get_direction(p->angle);
+
+    } else if (in->right && !g->dead) {
+        p->angle += dt * (PI * 2.0f) * 1.5f;
+        p->dir = get_direction(p->angle);
+    }
+
+    if(!g->dead) {
+        p->vel = vector2_scale(&p->vel, SDL_powf(1.0f - DRAG, k));
+        p->pos = vector2_add(p->pos, vector2_scale(&p->vel, k));
+        p->pos = vector2_modf(p->pos, R_WIDTH, R_HEIGHT);
+    }
+    prof_end(&prof, P_PLAYER);
+
+    prof_begin(&prof, P_ASTEROIDS);
+    for(int i = 0; i < a->size; i++) {
+        if(a->time[i] <= now && a->class[i] == DEAD) {
+            ast_remove(a, i);
+            i--;
+        }
+    }
+    if(g->ticks == g->stress.cascade) stress_cascade(g, now);
+
+    asteroids_integrate(a, dt, now);
+    grid_build(&g->grid, a, now);
+    if(!g->dead && !g->stress.on && grid_hit(&g->grid, a, p->pos.x, p->pos.y, now) >= 0) {
+        g->dead = true;
+        g->dtime = now + 1300;
+        g->angle = 0.0f;
+        particles_emit(&g->fx, (Emitter){p->pos.x, p->pos.y, 0.0f, 0.0f,
+                PLAYER_SPEED * 2.0f, 24, now + 400, 1300, AST_NONE});
+    }
+    prof_end(&prof, P_ASTEROIDS);
+
+    prof_begin(&prof, P_BULLETS);
+    /* A bullet splits at most one BIG into three, so this is all the
+     * room the loop can need and nothing reallocates inside it. */
+    asteroids_reserve(a, a->size + 2 * b->size);
+    shape_cache_reserve(&shapes, 2 * b->size);
+    bullets_expire(b, now);
+    bullets_collide(b, a, &g->grid, now, &g->rng[RNG_SPLIT], &g->fx);
+    bullets_integrate(b, dt, now);
+    prof_end(&prof, P_BULLETS);
+
+    prof_begin(&prof, P_PARTICLES);
+    particles_follow(&g->fx, a, now);
+    particles_tick(&g->fx, dt, now, &g->rng[RNG_SPARKS]);
+    prof_end(&prof, P_PARTICLES);
+
+    if(g->dead && g->dtime > now) {
+        p->vel.y = 0;
+        p->vel.x = 0;
+        g->angle += (PI/2) * dt;
+    } else {
+        if(g->dead) p->life--;
+        g->angle = 0.0f;
+        g->dead = false;
+    }
+}
+
+Uint8
+input_pack(const Input *in)
+{
+    return (Uint8)(in->thrust | in->left << 1 | in->right << 2 | in->fire << 3);
+}
+
+void
+input_unpack(Uint8 state, Input *in)
+{
+    in->thrust = state & 1;
+    in->left = (state >> 1) & 1;
+    in->right = (state >> 2) & 1;
+    in->fire = state >> 3;
+}
+
+void
+input_log_header(InputLog *log)
+{
+    bool ok = SDL_WriteIO(log->io, REC_MAGIC, 4) == 4
+        && SDL_WriteU16LE(log->io, REC_VERSION)
+        && SDL_WriteU16LE(log->io, log->hz)
+        && SDL_WriteU64LE(log->io, log->seed)
+        && SDL_WriteIO(log->io, log->build, REC_BUILD_LEN) == REC_BUILD_LEN
+        && SDL_WriteU64LE(log->io, log->ticks)
+        && SDL_WriteU64LE(log->io, log->checksum);
+    if (!ok) {
+        ERROR_EXIT(1, "Recording: write failed: %s\n", SDL_GetError());
+    }
+}
+
+void
+input_log_create(InputLog *log, const char *path, const Game *g)
+{
+    *log = (InputLog){.writing = true, .hz = (Uint16)g->hz, .seed = g->seed};
+    SDL_strlcpy(log->build, BUILD_ID, REC_BUILD_LEN);
+    log->io = SDL_IOFromFile(path, "wb");
+    if (!log->io) {
+        ERROR_EXIT(1, "Cannot record to %s: %s\n", path, SDL_GetError());
+    }
+    input_log_header(log);
+}
+
+void
+input_log_open(InputLog *log, const char *path)
+{
+    *log = (InputLog){.path = path};
+    log->io = SDL_IOFromFile(path, "rb");
+    if (!log->io) {
+        ERROR_EXIT(1, "Cannot replay %s: %s\n", path, SDL_GetError());
+    }
+    char magic[4];
+    Uint16 version;
+    bool ok = SDL_ReadIO(log->io, magic, 4) == 4 && SDL_memcmp(magic, REC_MAGIC, 4) == 0
+        && SDL_ReadU16LE(log->io, &version) && version == REC_VERSION
+        && SDL_ReadU16LE(log->io, &log->hz)
+        && SDL_ReadU64LE(log->io, &log->seed)
+        && SDL_ReadIO(log->io, log->build, REC_BUILD_LEN) == REC_BUILD_LEN
+        && SDL_ReadU64LE(log->io, &log->ticks)
+        && SDL_ReadU64LE(log->io, &log->checksum);
+    if (!ok || log->hz < SIM_MIN_HZ || log->hz > SIM_MAX_HZ) {
+        ERROR_EXIT(1, "%s is not a recording this build can read\n", path);
+    }
+    log->build[REC_BUILD_LEN - 1] = '\0';
+    if (SDL_strcmp(log->build, BUILD_ID) != 0) {
+        SDL_Log("Replay: recorded by build %s, this is %s; results may differ\n",
+                log->build, BUILD_ID);
+    }
+}
+
+void
+input_log_flush_run(InputLog *log)
+{
+    if (log->run == 0) return;
+    SDL_WriteU8(log->io, log->state);
+    for(Uint64 v = log->run; ; v >>= 7) {
+        if (v < 0x80) {
+            SDL_WriteU8(log->io, (Uint8)v);
+            break;
+        }
+        SDL_WriteU8(log->io, (Uint8)(v | 0x80));
+    }
+    log->run = 0;
+}
+
+void
+input_log_put(InputLog *log, const Input *in)
+{
+    Uint8 state = input_pack(in);
+    if (log->run && state != log->state) input_log_flush_run(log);
+    log->state = state;
+    log->run++;
+    log->ticks++;
+}
+
+/* Next tick's input; false once the recording is used up. A run length
+ * that is cut off, zero or longer than 64 bits means the file is bad. */
+bool
+input_log_get(InputLog *log, Input *in)
+{
+    if (log->run == 0) {
+        Uint8 b = 0x80;
+        if (!SDL_ReadU8(log->io, &log->state)) return false;
+        for(int shift = 0; b & 0x80; shift += 7) {
+            if (shift >= 64 || !SDL_ReadU8(log->io, &b)) break;
+            log->run |= (Uint64)(b & 0x7F) << shift;
+        }
+        if (b & 0x80 || log->run == 0) {
+            ERROR_EXIT(1, "%s is not a recording this build can read\n", log->path);
+        }
+    }
+    input_unpack(log->state, in);
+    log->run--;
+    return true;
+}
+
+/* Recording: writes the last run and patches the header with the tick
+ * count and the checksum a replay has to reproduce. */
+void
+input_log_close(InputLog *log, const Game *g)
+{
+    if (log->writing) {
+        input_log_flush_run(log);
+        log->checksum = g->checksum;
+        SDL_SeekIO(log->io, 0, SDL_IO_SEEK_SET);
+        input_log_header(log);
+        SDL_Log("Recorded %llu ticks, checksum %016llx\n",
+                (unsigned long long)log->ticks, (unsigned long long)log->checksum);
+    }
+    SDL_CloseIO(log->io);
+    log->io = NULL;
+}
+
+/* Stops on the tick the last life goes, so a recording never holds
+ * ticks its replay cannot reach. False once the run is over. */
+bool
+game_advance(Game *g, Input *in, double *acc, InputLog *rec)
+{
+    while (*acc >= g->dt) {
+        Input tick = *in;
+        tick.fire = SDL_min(in->fire, REC_MAX_FIRE);
+        in->fire -= tick.fire;
+        if (rec->io && !rec->writing && !input_log_get(rec, &tick)) return false;
+        if (rec->io && rec->writing) input_log_put(rec, &tick);
+        prof_begin(&prof, P_SIM);
+        game_tick(g, &tick);
+        prof_end(&prof, P_SIM);
+        if (rec->io) {
+            prof_begin(&prof, P_CHECKSUM);
+            g->checksum = game_checksum(g);
+            prof_end(&prof, P_CHECKSUM);
+        }
+        *acc -= g->dt;
+        if (g->p.life < 1) return false;
+    }
+    return true;
+}
+
+/* Replaces a's contents with n asteroids spawned the way the game does,
+ * a third of each class, from their own stream so a seed always gives
+ * the same field. Benches that want frozen entries set time afterwards. */
+void
+bench_field(Asteroids *a, int n, Uint64 seed)
+{
+    Uint64 rng = seed;
+    while(a->size) ast_remove(a, a->size - 1);
+    asteroids_reserve(a, n);
+    shape_cache_reserve(&shapes, n);
+    for(int i = 0; i < n; i++) ast_spawn(a, i % 3, 0, &rng);
+}
+
+/* ns per asteroid per tick for integrate + wrap + BENCH_PROBES bullet
+ * tests, the old per-struct path against Asteroids. Probes sit outside the
+ * world so every test scans the whole set, which is what a miss costs. */
+void
+bench_asteroids(void)
+{
+    static const int counts[] = {1000, 10000, 100000};
+    const float dt = 1.0f / SIM_HZ;
+    Uint64 freq = SDL_GetPerformanceFrequency();
+
+    for(size_t c = 0; c < SDL_arraysize(counts); c++) {
+        int n = counts[c];
+        int iters = SDL_max(10000000 / n, 20);
+
+        Asteroid *aos = SDL_malloc(n * sizeof(Asteroid));
+        Asteroids soa;
+        asteroids_init(&soa, n);
+        bench_field(&soa, n, 1);
+        for(int i = 0; i < n; i++) {
+            aos[i] = (Asteroid){
+                .pos = {soa.x[i], soa.y[i]},
+                .size = {soa.w[i], soa.h[i]},
+                .seed = soa.seed[i],
+                .shape = soa.shape[i],
+                .time = soa.time[i],
+                .angle = soa.angle[i],
+                .vel = SDL_sqrtf(soa.dx[i] * soa.dx[i] + soa.dy[i] * soa.dy[i]),
+                .as = soa.class[i]
+            };
+        }
+
+        Vector2 probe = {-1000.0f, -1000.0f};
+        int hits = 0;
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        for(int it = 0; it < iters; it++) {
+            Uint32 now = it;
+            for(int i = 0; i < n; i++) {
+                Vector2 dir = get_direction(aos[i].angle);
+                aos[i].pos = vector2_add(aos[i].pos, vector2_scale(&dir, dt * aos[i].vel));
+                aos[i].pos = vector2_modf(aos[i].pos, R_WIDTH, R_HEIGHT);
+            }
+            for(int k = 0; k < BENCH_PROBES; k++) {
+                for(int i = 0; i < n; i++) {
+                    if(collision(&probe, &aos[i].pos, &aos[i].size) && now > aos[i].time) {
+                        hits++;
+                        break;
+                    }
+                }
+            }
+        }
+        Uint64 t1 = SDL_GetPerformanceCounter();
+        for(int it = 0; it < iters; it++) {
+            Uint32 now = it;
+            asteroids_integrate(&soa, dt, now);
+            for(int k = 0; k < BENCH_PROBES; k++) {
+                hits += asteroids_hit(&soa, probe.x, probe.y, now) >= 0;
+            }
+        }
+        Uint64 t2 = SDL_GetPerformanceCounter();
+
+        double scale = 1e9 / (double)freq / ((double)iters * n);
+        double ns_aos = (double)(t1 - t0) * scale;
+        double ns_soa = (double)(t2 - t1) * scale;
+        SDL_Log("asteroids %6d: aos %7.2f ns  soa %7.2f ns  %.1fx  (%d hits)\n",
+                n, ns_aos, ns_soa, ns_aos / ns_soa, hits);
+
+        SDL_free(aos);
+        while(soa.size) ast_remove(&soa, soa.size - 1);
+        asteroids_destroy(&soa);
+    }
+}
+
+/* Runs every supported variant on the same input, including entries right
+ * on the world edges, frozen entries and a tail that is not a multiple of
+ * any vector width, and compares the result bit for bit with scalar. */
+bool
+kernels_check(void)
+{
+    enum { N = 1003 };
+    static float x[N], y[N], dx[N], dy[N], rx[N], ry[N], kx[N], ky[N];
+    static Uint32 time[N];
+    const float edge[] = {0.0f, -0.0f, R_WIDTH, R_HEIGHT, -1e-6f, R_WIDTH - 1e-4f};
+    const Uint32 now = 1000;
+
+    SDL_srand(2);
+    for(int i = 0; i < N; i++) {
+        x[i] = SDL_randf() * R_WIDTH;
+        y[i] = SDL_randf() * R_HEIGHT;
+        if (i % 7 == 0) x[i] = edge[i % SDL_arraysize(edge)];
+        if (i % 11 == 0) y[i] = edge[(i / 11) % SDL_arraysize(edge)];
+        dx[i] = (SDL_randf() * 2.0f - 1.0f) * 600.0f;
+        dy[i] = (SDL_randf() * 2.0f - 1.0f) * 600.0f;
+        Uint32 t[] = {0, now, now + 1, 0xFFFFFFFFu, 0x80000000u};
+        time[i] = t[i % SDL_arraysize(t)];
+    }
+
+    bool ok = true;
+    for(int pass = 0; pass < 2; pass++) {
+        const Uint32 *tm = pass ? time : NULL;
+        SDL_memcpy(rx, x, sizeof(x));
+        SDL_memcpy(ry, y, sizeof(y));
+        integrate_wrap_scalar(rx, ry, dx, dy, tm, now, 1.0f / 60.0f, N);
+
+        for(size_t k = 1; k < SDL_arraysize(kernels); k++) {
+            if (kernels[k].supported && !kernels[k].supported()) continue;
+            SDL_memcpy(kx, x, sizeof(x));
+            SDL_memcpy(ky, y, sizeof(y));
+            kernels[k].fn(kx, ky, dx, dy, tm, now, 1.0f / 60.0f, N);
+            bool same = SDL_memcmp(kx, rx, sizeof(rx)) == 0 && SDL_memcmp(ky, ry, sizeof(ry)) == 0;
+            SDL_Log("check %-6s %s: %s\n", kernels[k].name, tm ? "frozen" : "all",
+                    same ? "bit-exact" : "MISMATCH");
+            ok = ok && same;
+        }
+    }
+    return ok;
+}
+
+/* Entities per second for each supported variant, at a size that stays in
+ * cache and one that streams from memory. */
+void
+bench_kernels(void)
+{
+    static const int counts[] = {4096, 1 << 20};
+    Uint64 freq = SDL_GetPerformanceFrequency();
+
+    for(size_t c = 0; c < SDL_arraysize(counts); c++) {
+        int n = counts[c];
+        Asteroids a;
+        asteroids_init(&a, n);
+        bench_field(&a, n, 3);
+        for(int i = 0; i < n; i += 16) a.time[i] = 0xFFFFFFFFu;
+
+        int iters = SDL_max((1 << 28) / n, 4);
+        for(size_t k = 0; k < SDL_arraysize(kernels); k++) {
+            if (kernels[k].supported && !kernels[k].supported()) continue;
+            Uint64 t0 = SDL_GetPerformanceCounter();
+            for(int it = 0; it < iters; it++) {
+                kernels[k].fn(a.x, a.y, a.dx, a.dy, a.time, it, 1.0f / 60.0f, n);
+            }
+            Uint64 t1 = SDL_GetPerformanceCounter();
+            double secs = (double)(t1 - t0) / (double)freq;
+            SDL_Log("integrate_wrap %-6s n=%7d: %8.1f M entities/s\n", kernels[k].name, n,
+                    (double)iters * n / secs / 1e6);
+        }
+        while(a.size) ast_remove(&a, a.size - 1);
+        asteroids_destroy(&a);
+    }
+}
+
+/* Per-tick cost of CAPACITY bullet queries, linear scan against grid
+ * rebuild plus grid queries, and a cross-check that both find the same
+ * asteroids. */
+bool
+bench_broadphase(void)
+{
+    static const int counts[] = {100, 1000, 10000};
+    Uint64 freq = SDL_GetPerformanceFrequency();
+    Vector2 bullet[CAPACITY];
+    bool ok = true;
+
+    for(size_t c = 0; c < SDL_arraysize(counts); c++) {
+        int n = counts[c];
+        Asteroids a;
+        asteroids_init(&a, n);
+        bench_field(&a, n, 4);
+        for(int i = 0; i < n; i += 10) a.time[i] = 2000;
+        Grid grid;
+        grid_init(&grid, GRID_CELL);
+
+        SDL_srand(4);
+        for(int i = 0; i < CAPACITY; i++) {
+            bullet[i] = (Vector2){SDL_randf() * R_WIDTH, SDL_randf() * R_HEIGHT};
+        }
+
+        int iters = SDL_max(2000000 / n, 20);
+        long sum_linear = 0, sum_grid = 0;
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        for(int it = 0; it < iters; it++) {
+            for(int i = 0; i < CAPACITY; i++) {
+                sum_linear += asteroids_hit(&a, bullet[i].x, bullet[i].y, 1000);
+            }
+        }
+        Uint64 t1 = SDL_GetPerformanceCounter();
+        for(int it = 0; it < iters; it++) {
+            grid_build(&grid, &a, 1000);
+            for(int i = 0; i < CAPACITY; i++) {
+                sum_grid += grid_hit(&grid, &a, bullet[i].x, bullet[i].y, 1000);
+            }
+        }
+        Uint64 t2 = SDL_GetPerformanceCounter();
+
+        double us = 1e6 / (double)freq / iters;
+        SDL_Log("broadphase %5d asteroids x %d bullets: linear %8.2f us  grid %8.2f us  %s\n",
+                n, CAPACITY, (double)(t1 - t0) * us, (double)(t2 - t1) * us,
+                sum_linear == sum_grid ? "same hits" : "MISMATCH");
+        ok = ok && sum_linear == sum_grid;
+
+        while(a.size) ast_remove(&a, a.size - 1);
+        grid_destroy(&grid);
+        asteroids_destroy(&a);
+    }
+    return ok;
+}
+
+/* An emitter following the last of four asteroids has to stay on it when
+ * an earlier one is removed and the piece moves down, and retire once
+ * the piece itself is removed. */
+bool
+follow_check(void)
+{
+    Asteroids a;
+    asteroids_init(&a, 4);
+    bench_field(&a, 4, 10);
+    static Particles p;
+    particles_init(&p, 64);
+    particles_emit(&p, (Emitter){0.0f, 0.0f, 0.0f, 0.0f, 10.0f, 1, 1000, 100,
+            ast_handle(&a, 3)});
+    float x = a.x[3], y = a.y[3];
+
+    ast_remove(&a, 0);
+    particles_follow(&p, &a, 0);
+    bool ok = p.nr_emitters == 1 && p.emitter[0].x == x && p.emitter[0].y == y;
+    ast_remove(&a, 0);
+    particles_follow(&p, &a, 0);
+    ok = ok && p.nr_emitters == 0;
+    SDL_Log("follow: emitter %s\n", ok ? "tracks its asteroid" : "LOST ITS ASTEROID");
+
+    particles_destroy(&p);
+    while(a.size) ast_remove(&a, a.size - 1);
+    asteroids_destroy(&a);
+    return ok;
+}
+
+/* Live handles must resolve to their asteroid and removed ones must
+ * stop resolving while the pool churns. */
+bool
+asteroids_check(void)
+{
+    static const int counts[] = {1000, 50000};
+    bool ok = true;
+
+    for(size_t c = 0; c < SDL_arraysize(counts); c++) {
+        int n = counts[c];
+        Asteroids a;
+        asteroids_init(&a, AST_CHUNK);
+        AstHandle *live = SDL_malloc(n * sizeof(AstHandle));
+        int *tag = SDL_malloc(n * sizeof(int));
+        AstHandle dead = AST_NONE;
+
+        SDL_srand(6);
+        Uint64 rng = 6;
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        for(int k = 0; k < n; k++) {
+            int i = ast_spawn(&a, SDL_rand(3), 0, &rng);
+            a.seed[i] = tag[k] = k;
+            live[k] = ast_handle(&a, i);
+        }
+        Uint64 t1 = SDL_GetPerformanceCounter();
+        int churn = n * 4;
+        for(int k = 0; k < churn; k++) {
+            int j = SDL_rand(n);
+            int i = ast_lookup(&a, live[j]);
+            ok = ok && i >= 0 && a.seed[i] == tag[j];
+            dead = live[j];
+            ast_remove(&a, i);
+            ok = ok && ast_lookup(&a, dead) < 0;
+            i = ast_spawn(&a, SDL_rand(3), 0, &rng);
+            a.seed[i] = tag[j] = n + k;
+            live[j] = ast_handle(&a, i);
+        }
+        Uint64 t2 = SDL_GetPerformanceCounter();
+        for(int j = 0; j < n; j++) {
+            int i = ast_lookup(&a, live[j]);
+            ok = ok && i >= 0 && a.seed[i] == tag[j];
+        }
+        ok = ok && a.size == n && ast_lookup(&a, AST_NONE) < 0;
+
+        double ns = 1e9 / (double)SDL_GetPerformanceFrequency();
+        SDL_Log("pool %5d asteroids: spawn %.1f ns  remove+spawn %.1f ns  cap %d  %s\n",
+                n, (double)(t1 - t0) * ns / n, (double)(t2 - t1) * ns / churn,
+                a.cap, ok ? "handles ok" : "HANDLE MISMATCH");
+
+        while(a.size) ast_remove(&a, a.size - 1);
+        SDL_free(live);
+        SDL_free(tag);
+        asteroids_destroy(&a);
+    }
+    return ok && follow_check();
+}
+
+/* Each bullet's x carries its spawn number, so a lifetime separated
+ * from its bullet shows up as a mismatch. */
+bool
+bullets_check(void)
+{
+    enum { CAP = 1024, N = 1500 };
+    Bullets b;
+    bool ok = true;
+
+    for(int policy = BULLET_DROP_NEW; policy <= BULLET_DROP_OLDEST; policy++) {
+        bullets_init(&b, CAP, policy);
+        for(int k = 0; k < N; k++) {
+            bullets_spawn(&b, (Vector2){(float)k, 0.0f}, (Vector2){0.0f, 0.0f}, k);
+        }
+        int first = policy == BULLET_DROP_NEW ? 0 : N - CAP;
+        ok = ok && b.size == CAP && b.dropped == N - CAP && b.x[b.head] == first;
+        for(int i = b.head; i < b.head + b.size; i++) {
+            ok = ok && b.expire[i] == (Uint32)b.x[i] + BULLET_LIFE;
+        }
+
+        Uint32 now = first + BULLET_LIFE + 100;
+        bullets_expire(&b, now);
+        ok = ok && b.expired == 100 && b.x[b.head] == first + 100;
+        bullets_destroy(&b);
+    }
+
+    Asteroids a;
+    Grid grid;
+    asteroids_init(&a, 1);
+    grid_init(&grid, GRID_CELL);
+    Uint64 rng = 7;
+    int t = ast_spawn(&a, BIG, 0, &rng);
+    ast_place(&a, t, R_WIDTH / 2, R_HEIGHT / 2);
+    grid_build(&grid, &a, 0);
+
+    /* Bullets sweep across the asteroid; only the first inside hits, the
+     * split freezes the rest of it. */
+    bullets_init(&b, CAP, BULLET_DROP_NEW);
+    int target = -1;
+    for(int k = 0; k < 64; k++) {
+        float x = R_WIDTH / 2 - 64.0f + 2.0f * k;
+        if (target < 0 && ast_contains(&a, t, x, R_HEIGHT / 2)) target = k;
+        bullets_spawn(&b, (Vector2){x, R_HEIGHT / 2}, (Vector2){0.0f, 0.0f}, k);
+    }
+    bullets_collide(&b, &a, &grid, 1, &rng, NULL);
+    ok = ok && target >= 0 && b.hits == 1 && b.size == 63 && a.size == 3;
+    for(int i = 0, k = 0; i < b.size; i++, k++) {
+        if (k == target) k++;
+        ok = ok && b.x[i] == R_WIDTH / 2 - 64.0f + 2.0f * k
+            && b.expire[i] == (Uint32)k + BULLET_LIFE;
+    }
+    bullets_destroy(&b);
+    while(a.size) ast_remove(&a, a.size - 1);
+
+    SDL_srand(7);
+    for(int i = 0; i < 200; i++) {
+        ast_spawn(&a, SDL_rand(3), 0, &rng);
+    }
+    bullets_init(&b, BULLET_CAP, BULLET_DROP_OLDEST);
+    int ticks = 600;
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    for(int tick = 1; tick <= ticks; tick++) {
+        Uint32 now = tick * 1000 / SIM_HZ;
+        for(int k = 0; k < BULLET_CAP / 64; k++) {
+            Vector2 dir = get_direction(SDL_randf() * TAU);
+            bullets_spawn(&b, (Vector2){SDL_randf() * R_WIDTH, SDL_randf() * R_HEIGHT},
+                    vector2_scale(&dir, BULLET_SPEED), now);
+        }
+        bullets_expire(&b, now);
+        grid_build(&grid, &a, now);
+        bullets_collide(&b, &a, &grid, now, &rng, NULL);
+        bullets_integrate(&b, 1.0f / SIM_HZ, now);
+    }
+    Uint64 t1 = SDL_GetPerformanceCounter();
+    SDL_Log("bullets: %.1f us/tick, %d live; %llu fired, %llu hit, %llu expired, %llu dropped  %s\n",
+            (double)(t1 - t0) * 1e6 / (double)SDL_GetPerformanceFrequency() / ticks, b.size,
+            (unsigned long long)b.fired, (unsigned long long)b.hits,
+            (unsigned long long)b.expired, (unsigned long long)b.dropped,
+            ok ? "lifetimes ok" : "LIFETIME MISMATCH");
+    ok = ok && b.fired == b.hits + b.expired + b.dropped + b.size;
+
+    bullets_destroy(&b);
+    while(a.size) ast_remove(&a, a.size - 1);
+    grid_destroy(&grid);
+    asteroids_destroy(&a);
+    return ok;
+}
+
+/* Two games from one seed fed the same scripted input must agree on every
+ * tick's checksum; a third from the next seed must not. */
+bool
+sim_check(void)
+{
+    enum { TICKS = 1200 };
+    static Game g[3];
+    Uint64 seed[3] = {42, 42, 43};
+    for(int k = 0; k < 3; k++) game_init(&g[k], SIM_HZ, seed[k]);
+
+    int diverged = -1;
+    bool differs = false;
+    for(Uint64 t = 0; t < TICKS; t++) {
+        for(int k = 0; k < 3; k++) {
+            Input in = {
+                .thrust = t % 90 < 30,
+                .left = t % 200 < 50,
+                .fire = t % 8 == 0
+            };
+            game_tick(&g[k], &in);
+            g[k].checksum = game_checksum(&g[k]);
+        }
+        if (diverged < 0 && g[0].checksum != g[1].checksum) diverged = (int)t;
+        differs = differs || g[0].checksum != g[2].checksum;
+    }
+    SDL_Log("sim: %d ticks seed %llu checksum %016llx, %s; seed %llu %s\n",
+            TICKS, (unsigned long long)seed[0], (unsigned long long)g[0].checksum,
+            diverged < 0 ? "replay identical" : "REPLAY DIVERGED",
+            (unsigned long long)seed[2], differs ? "differs" : "SAME AS OTHER SEED");
+    for(int k = 0; k < 3; k++) game_destroy(&g[k]);
+    return diverged < 0 && differs;
+}
+
+/* Records a game to its game over at an uneven 1-3 ticks a frame, then
+ * replays it uncapped at one tick a frame, as --record and --replay do;
+ * the replay has to end on the same tick with the same checksum. */
+bool
+replay_check(void)
+{
+    enum { MAX_FRAMES = 100000 };
+    const char *path = "replay_check.rec";
+    static Game g;
+    InputLog rec;
+    Input in = {0};
+    double acc = 0.0;
+
+    game_init(&g, SIM_HZ, 7);
+    input_log_create(&rec, path, &g);
+    for(int f = 0; f < MAX_FRAMES; f++) {
+        in.thrust = f % 50 < 20;
+        in.right = f % 130 < 30;
+        in.fire += f % 5 == 0;
+        acc += g.dt * (0.5 + (f % 4) * 0.75);
+        if (!game_advance(&g, &in, &acc, &rec)) break;
+    }
+    bool over = g.p.life < 1;
+    input_log_close(&rec, &g);
+    game_destroy(&g);
+
+    input_log_open(&rec, path);
+    game_init(&g, rec.hz, rec.seed);
+    in = (Input){0};
+    do {
+        acc = g.dt;
+    } while (game_advance(&g, &in, &acc, &rec));
+    bool ok = over && g.ticks == rec.ticks && g.checksum == rec.checksum;
+    SDL_Log("replay: game over at tick %llu, replayed %llu ticks, %s\n",
+            (unsigned long long)rec.ticks, (unsigned long long)g.ticks,
+            !over ? "NO GAME OVER" : ok ? "checksum matches" : "CHECKSUM MISMATCH");
+    input_log_close(&rec, &g);
+    game_destroy(&g);
+    SDL_RemovePath(path);
+    return ok;
+}
+
+/* Average cost of one asteroid test on points scattered within twice the
+ * outline radius, the old double-sqrt circle against bounding reject plus
+ * polygon, and how often each reports a hit. */
+void
+bench_narrowphase(void)
+{
+    enum { N = 1024, POINTS = 4096 };
+    Asteroids a;
+    asteroids_init(&a, N);
+    bench_field(&a, N, 5);
+    static Vector2 pt[POINTS];
+    static int idx[POINTS];
+
+    SDL_srand(5);
+    for(int k = 0; k < POINTS; k++) {
+        int i = idx[k] = SDL_rand(N);
+        float r = a.radius[i] * 2.0f * SDL_randf();
+        float t = SDL_randf() * TAU;
+        pt[k] = (Vector2){a.x[i] + r * SDL_cosf(t), a.y[i] + r * SDL_sinf(t)};
+    }
+
+    int iters = 500;
+    int circle = 0, poly = 0;
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    for(int it = 0; it < iters; it++) {
+        for(int k = 0; k < POINTS; k++) {
+            int i = idx[k];
+            Vector2 pos = {a.x[i], a.y[i]}, size = {a.w[i], a.h[i]};
+            circle += collision(&pt[k], &pos, &size);
+        }
+    }
+    Uint64 t1 = SDL_GetPerformanceCounter();
+    for(int it = 0; it < iters; it++) {
+        for(int k = 0; k < POINTS; k++) {
+            poly += ast_contains(&a, idx[k], pt[k].x, pt[k].y);
+        }
+    }
+    Uint64 t2 = SDL_GetPerformanceCounter();
+
+    double ns = 1e9 / (double)SDL_GetPerformanceFrequency() / ((double)iters * POINTS);
+    SDL_Log("narrowphase: circle %.2f ns (%.1f%% hit)  outline %.2f ns (%.1f%% hit)\n",
+            (double)(t1 - t0) * ns, 100.0 * circle / ((double)iters * POINTS),
+            (double)(t2 - t1) * ns, 100.0 * poly / ((double)iters * POINTS));
+
+    while(a.size) ast_remove(&a, a.size - 1);
+    asteroids_destroy(&a);
+}
+
+/* Tick and draw cost with about 100k live particles from a few hundred
+ * overlapping emitters, on the calling thread only. */
+void
+bench_particles(void)
+{
+    int cores = jobs.threads;
+    jobs_shutdown();
+    jobs_init(1);
+
+    Particles p;
+    particles_init(&p, PARTICLE_CAP);
+    Batch b = {0};
+    Uint64 rng = 9;
+    int ticks = 600, warm = 120;
+    Uint64 tick_time = 0, draw_time = 0;
+    long live = 0;
+
+    for(int tick = 1; tick <= ticks; tick++) {
+        Uint32 now = tick * 1000 / SIM_HZ;
+        while(p.nr_emitters < 256) {
+            particles_emit(&p, (Emitter){SDL_randf_r(&rng) * R_WIDTH,
+                    SDL_randf_r(&rng) * R_HEIGHT, 0.0f, 0.0f, 150.0f, 9,
+                    now + 250 + SDL_rand_r(&rng, 500), 1000, AST_NONE});
+        }
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        particles_tick(&p, 1.0f / SIM_HZ, now, &rng);
+        Uint64 t1 = SDL_GetPerformanceCounter();
+        b.nr_v = 0;
+        particles_draw(&p, 0.5f, &b);
+        Uint64 t2 = SDL_GetPerformanceCounter();
+        if (tick <= warm) continue;
+        tick_time += t1 - t0;
+        draw_time += t2 - t1;
+        live += p.size;
+    }
+
+    double us = 1e6 / (double)SDL_GetPerformanceFrequency() / (ticks - warm);
+    SDL_Log("particles: %ld live, tick %.1f us, draw %.1f us, %llu dropped\n",
+            live / (ticks - warm), (double)tick_time * us, (double)draw_time * us,
+            (unsigned long long)p.dropped);
+    SDL_free(b.vert);
+    particles_destroy(&p);
+    jobs_shutdown();
+    jobs_init(cores);
+}
+
+/* The ring must match the CPU pool record for record, including across
+ * a wrap and a drain. Needs a GL context. */
+bool
+gpu_particles_check(void)
+{
+    enum { TICKS = 900, RING = 1024, QUIET = 400, LOUD = 520 };
+    const float dt = 1.0f / SIM_HZ;
+    static Particles cpu, gpu;
+    static Spawn back[RING];
+    GpuParticles gp;
+    particles_init(&cpu, PARTICLE_CAP);
+    particles_init(&gpu, PARTICLE_CAP);
+    gpu.deferred = true;
+    gpu_particles_init(&gp, RING);
+    Uint64 rng[2] = {11, 11};
+    Uint64 script = 3;
+
+    bool ok = true, drained = false;
+    float worst = 0.0f;
+    int frames = 0, most = 0, wrapped = 0;
+    for(int tick = 1; tick <= TICKS; tick++) {
+        Uint32 now = tick * 1000 / SIM_HZ;
+        if ((tick < QUIET || tick >= LOUD) && tick % 6 == 0) {
+            Emitter e = {SDL_randf_r(&script) * R_WIDTH, SDL_randf_r(&script) * R_HEIGHT,
+                40.0f, -25.0f, 300.0f, 12, now + 50, 600, AST_NONE};
+            particles_emit(&cpu, e);
+            particles_emit(&gpu, e);
+        }
+        particles_tick(&cpu, dt, now, &rng[0]);
+        particles_tick(&gpu, dt, now, &rng[1]);
+        if (tick % 3 != 0 && tick % 7 != 0 && tick != TICKS) continue;
+
+        gpu_particles_update(&gp, &gpu, dt, now);
+        frames++;
+        drained = drained || (tick >= QUIET && tick < LOUD && cpu.size == 0 && gp.count == 0);
+        int first[2], nr[2];
+        wrapped += gpu_particles_runs(&gp, first, nr) == 2;
+        int n = gpu_particles_read(&gp, back);
+        int live = 0;
+        for(int i = 0; i < n && ok; i++) {
+            if (back[i].expire <= now) continue;
+            if (live == cpu.size || back[i].expire != cpu.expire[live]) {
+                ok = false;
+                break;
+            }
+            float ex = SDL_fabsf(back[i].x - cpu.x[live]);
+            float ey = SDL_fabsf(back[i].y - cpu.y[live]);
+            worst = SDL_max(worst, SDL_min(ex, R_WIDTH - ex));
+            worst = SDL_max(worst, SDL_min(ey, R_HEIGHT - ey));
+            live++;
+        }
+        ok = ok && live == cpu.size;
+        most = SDL_max(most, gp.count);
+    }
+    ok = ok && drained && wrapped && worst < 0.01f;
+    SDL_Log("gpu particles: %d frames (%d wrapped), ring up to %d of %d, %.1f records/step, "
+            "max error %.5f px, %s%s\n", frames, wrapped, most, RING,
+            gp.steps ? (double)gp.stepped / gp.steps : 0.0, worst,
+            drained ? "drains" : "NEVER DRAINS", ok ? ", matches cpu" : ", CPU MISMATCH");
+    gpu_particles_destroy(&gp);
+    particles_destroy(&gpu);
+    particles_destroy(&cpu);
+    return ok;
+}
+
+/* Per-tick integrate, grid build and 4096 bullet queries at 100k and 1M
+ * asteroids, on 1 thread, 4 threads and one per core. Every run has to
+ * produce the same positions, grid, hits and instances bit for bit. */
+bool
+bench_jobs(void)
+{
+    static const int counts[] = {100000, 1000000};
+    int cores = jobs.threads;
+    int threads[] = {1, 4, cores};
+    bool ok = true;
+
+    for(size_t c = 0; c < SDL_arraysize(counts); c++) {
+        int n = counts[c];
+        Asteroids a;
+        asteroids_init(&a, n);
+        bench_field(&a, n, 8);
+        for(int i = 0; i < n; i += 10) a.time[i] = 0xFFFFFFFFu;
+        float *x0 = SDL_malloc(n * sizeof(float));
+        float *y0 = SDL_malloc(n * sizeof(float));
+        SDL_memcpy(x0, a.x, n * sizeof(float));
+        SDL_memcpy(y0, a.y, n * sizeof(float));
+        SDL_srand(8);
+        Bullets b;
+        bullets_init(&b, BULLET_CAP, BULLET_DROP_NEW);
+        for(int i = 0; i < BULLET_CAP; i++) {
+            bullets_spawn(&b, (Vector2){SDL_randf() * R_WIDTH, SDL_randf() * R_HEIGHT},
+                    (Vector2){0.0f, 0.0f}, 0);
+        }
+        Grid grid;
+        grid_init(&grid, GRID_CELL);
+
+        int ticks = SDL_max(5000000 / n, 5);
+        Uint64 sum[SDL_arraysize(threads)];
+        double base = 0.0;
+        for(size_t t = 0; t < SDL_arraysize(threads); t++) {
+            jobs_shutdown();
+            jobs_init(threads[t]);
+            SDL_memcpy(a.x, x0, n * sizeof(float));
+            SDL_memcpy(a.y, y0, n * sizeof(float));
+
+            Uint64 phase[3] = {0};
+            for(int tick = 1; tick <= ticks; tick++) {
+                Uint64 t0 = SDL_GetPerformanceCounter();
+                asteroids_integrate(&a, 1.0f / SIM_HZ, tick);
+                Uint64 t1 = SDL_GetPerformanceCounter();
+                grid_build(&grid, &a, tick);
+                Uint64 t2 = SDL_GetPerformanceCounter();
+                QueryJob q = {&b, &a, &grid, tick};
+                parallel_for(bullets_query_job, &q, b.size, job_grain(b.size, JOB_GRAIN / 16));
+                Uint64 t3 = SDL_GetPerformanceCounter();
+                phase[0] += t1 - t0;
+                phase[1] += t2 - t1;
+                phase[2] += t3 - t2;
+            }
+            sum[t] = hash_bytes(0, a.x, n * sizeof(float));
+            sum[t] = hash_bytes(sum[t], a.y, n * sizeof(float));
+            sum[t] = hash_bytes(sum[t], grid.items, grid.size * sizeof(int));
+            sum[t] = hash_bytes(sum[t], b.hit, b.size * sizeof(int));
+            Instances in = {0};
+            draw_asteroids(&a, ticks, 0.5f, &in);
+            sum[t] = hash_bytes(sum[t], in.data, in.size * sizeof(Instance));
+            SDL_free(in.data);
+            ok = ok && sum[t] == sum[0];
+
+            double ms = 1e3 / (double)SDL_GetPerformanceFrequency() / ticks;
+            double total = (double)(phase[0] + phase[1] + phase[2]) * ms;
+            if (t == 0) base = total;
+            SDL_Log("jobs %7d asteroids %2d threads: integrate %6.2f  grid %6.2f  "
+                    "queries %6.2f ms/tick  %.2fx  %s\n", n, jobs.threads,
+                    (double)phase[0] * ms, (double)phase[1] * ms, (double)phase[2] * ms,
+                    base / total, sum[t] == sum[0] ? "same result" : "MISMATCH");
+        }
+
+        grid_destroy(&grid);
+        bullets_destroy(&b);
+        while(a.size) ast_remove(&a, a.size - 1);
+        asteroids_destroy(&a);
+        SDL_free(x0);
+        SDL_free(y0);
+    }
+    jobs_shutdown();
+    jobs_init(cores);
+    return ok;
+}
+
+/* Inputs shared by every microbenchmark case at one entity count, all
+ * from fixed seeds: n asteroids of mixed sizes with their grid, a point
+ * near each asteroid, and vector pairs and angles for the math cases. */
+typedef struct {
+    int n;
+    Vector2 *va, *vb;
+    float *angle;
+    Asteroids a;
+    Grid grid;
+    Instances inst;
+} MicroState;
+
+/* run does one pass over all n entities and returns something derived
+ * from the results so the work cannot be dropped. A case with a reset
+ * changes its input and gets it rebuilt, untimed, before every pass. */
+typedef struct {
+    const char *name;
+    float (*run)(MicroState *s);
+    void (*reset)(MicroState *s);
+} MicroCase;
+
+typedef struct {
+    const char *name;
+    int n;
+    int reps;
+    float median, min, max;
+} MicroResult;
+
+volatile float micro_sink;
+
+void
+micro_reset_asteroids(MicroState *s)
+{
+    bench_field(&s->a, s->n, MICRO_SEED);
+    asteroids_reserve(&s->a, 3 * s->n);
+    shape_cache_reserve(&shapes, 3 * s->n);
+}
+
+void
+micro_setup(MicroState *s, int n)
+{
+    *s = (MicroState){.n = n};
+    s->va = SDL_malloc(n * sizeof(Vector2));
+    s->vb = SDL_malloc(n * sizeof(Vector2));
+    s->angle = SDL_malloc(n * sizeof(float));
+    asteroids_init(&s->a, 3 * n);
+    micro_reset_asteroids(s);
+    grid_init(&s->grid, GRID_CELL);
+    grid_build(&s->grid, &s->a, 0);
+    s->inst = instances_init(pipeline_find("outlines"), 4);
+
+    /* Points land within two radii of their asteroid, so about half hit;
+     * steps reach past half the world, so some lerps wrap. */
+    Uint64 rng = MICRO_SEED + 1;
+    for(int i = 0; i < n; i++) {
+        float r = s->a.radius[i] * 2.0f * SDL_randf_r(&rng);
+        float t = SDL_randf_r(&rng) * TAU;
+        s->va[i] = (Vector2){s->a.x[i] + r * SDL_cosf(t), s->a.y[i] + r * SDL_sinf(t)};
+        s->vb[i] = (Vector2){SDL_randf_r(&rng) * R_WIDTH, SDL_randf_r(&rng) * R_HEIGHT};
+        s->angle[i] = ((SDL_randf_r(&rng) * 2.0f) - 1.0f) * TAU;
+    }
+}
+
+void
+micro_teardown(MicroState *s)
+{
+    SDL_free(s->va);
+    SDL_free(s->vb);
+    SDL_free(s->angle);
+    SDL_free(s->inst.data);
+    grid_destroy(&s->grid);
+    while(s->a.size) ast_remove(&s->a, s->a.size - 1);
+    asteroids_destroy(&s->a);
+}
+
+float
+micro_vector2_add_scale(MicroState *s)
+{
+    float sum = 0.0f;
+    for(int i = 0; i < s->n; i++) {
+        sum += vector2_add(s->va[i], vector2_scale(&s->vb[i], 0.5f)).x;
+    }
+    return sum;
+}
+
+float
+micro_vector2_modf(MicroState *s)
+{
+    float sum = 0.0f;
+    for(int i = 0; i < s->n; i++) {
+        sum += vector2_modf(vector2_add(s->va[i], s->vb[i]), R_WIDTH, R_HEIGHT).x;
+    }
+    return sum;
+}
+
+float
+micro_vector2_lerp_wrap(MicroState *s)
+{
+    float sum = 0.0f;
+    for(int i = 0; i < s->n; i++) {
+        sum += vector2_lerp_wrap(s->va[i], s->vb[i], 0.5f).x;
+    }
+    return sum;
+}
+
+float
+micro_get_direction(MicroState *s)
+{
+    float sum = 0.0f;
+    for(int i = 0; i < s->n; i++) sum += get_direction(s->angle[i]).x;
+    return sum;
+}
+
+float
+micro_collision(MicroState *s)
+{
+    int hits = 0;
+    for(int i = 0; i < s->n; i++) {
+        Vector2 pos = {s->a.x[i], s->a.y[i]}, size = {s->a.w[i], s->a.h[i]};
+        hits += collision(&s->va[i], &pos, &size);
+    }
+    return (float)hits;
+}
+
+float
+micro_ast_contains(MicroState *s)
+{
+    int hits = 0;
+    for(int i = 0; i < s->n; i++) hits += ast_contains(&s->a, i, s->va[i].x, s->va[i].y);
+    return (float)hits;
+}
+
+float
+micro_grid_hit(MicroState *s)
+{
+    int hits = 0;
+    for(int i = 0; i < s->n; i++) {
+        hits += grid_hit(&s->grid, &s->a, s->va[i].x, s->va[i].y, 0) >= 0;
+    }
+    return (float)hits;
+}
+
+float
+micro_shape_alloc(MicroState *s)
+{
+    int sum = 0;
+    for(int i = 0; i < s->n; i++) {
+        int slot = shape_alloc(&shapes, (int)((Uint32)i * 2654435761u));
+        sum += slot;
+        shape_free(&shapes, slot);
+    }
+    return (float)sum;
+}
+
+float
+micro_draw_asteroids(MicroState *s)
+{
+    s->inst.size = 0;
+    draw_asteroids(&s->a, 0, 0.5f, &s->inst);
+    return (float)s->inst.size;
+}
+
+float
+micro_integrate_wrap(MicroState *s)
+{
+    integrate_wrap(s->a.x, s->a.y, s->a.dx, s->a.dy, s->a.time, 0, 1.0f / SIM_HZ, s->n);
+    return s->a.x[0];
+}
+
+float
+micro_ast_hit(MicroState *s)
+{
+    Uint64 rng = MICRO_SEED + 2;
+    for(int i = 0; i < s->n; i++) ast_hit(&s->a, i, 1, &rng);
+    return (float)s->a.size;
+}
+
+/* In the order they run; integrate_wrap moves the field, so everything
+ * that uses the points near each asteroid runs before it. ast_hit
+ * rebuilds the field and goes last. */
+static const MicroCase micro_cases[] = {
+    {"vector2_add_scale", micro_vector2_add_scale, NULL},
+    {"vector2_modf", micro_vector2_modf, NULL},
+    {"vector2_lerp_wrap", micro_vector2_lerp_wrap, NULL},
+    {"get_direction", micro_get_direction, NULL},
+    {"collision", micro_collision, NULL},
+    {"ast_contains", micro_ast_contains, NULL},
+    {"grid_hit", micro_grid_hit, NULL},
+    {"shape_alloc", micro_shape_alloc, NULL},
+    {"draw_asteroids", micro_draw_asteroids, NULL},
+    {"integrate_wrap", micro_integrate_wrap, NULL},
+    {"ast_hit", micro_ast_hit, micro_reset_asteroids},
+};
+
+/* Doubles the passes per sample until one sample takes MICRO_SAMPLE_NS
+ * (these runs are the warm-up), then takes MICRO_SAMPLES samples. Times
+ * are ns per entity per pass. */
+MicroResult
+micro_run(const MicroCase *c, MicroState *s)
+{
+    float sample[MICRO_SAMPLES];
+    double ns = 1e9 / (double)SDL_GetPerformanceFrequency();
+    int reps = 1;
+    for(;;) {
+        if (c->reset) c->reset(s);
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        for(int r = 0; r < reps; r++) micro_sink += c->run(s);
+        Uint64 t1 = SDL_GetPerformanceCounter();
+        if (c->reset || (double)(t1 - t0) * ns >= MICRO_SAMPLE_NS) break;
+        reps *= 2;
+    }
+
+    for(int k = 0; k < MICRO_SAMPLES; k++) {
+        if (c->reset) c->reset(s);
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        for(int r = 0; r < reps; r++) micro_sink += c->run(s);
+        Uint64 t1 = SDL_GetPerformanceCounter();
+        sample[k] = (float)((double)(t1 - t0) * ns / ((double)reps * s->n));
+    }
+    SDL_qsort(sample, MICRO_SAMPLES, sizeof(float), cmp_float);
+    return (MicroResult){c->name, s->n, reps, sample[MICRO_SAMPLES / 2], sample[0],
+        sample[MICRO_SAMPLES - 1]};
+}
+
+/* Returns the text after "key": in s, or NULL. */
+const char *
+micro_field(const char *s, const char *key)
+{
+    char pat[32];
+    SDL_snprintf(pat, sizeof(pat), "\"%s\": ", key);
+    const char *p = SDL_strstr(s, pat);
+    return p ? p + SDL_strlen(pat) : NULL;
+}
+
+/* Reads a file written by micro_write and lines every case up with it.
+ * False when a case got more than threshold percent slower. */
+bool
+micro_compare(const char *path, const MicroResult *res, int nr, double threshold)
+{
+    char *json = SDL_LoadFile(path, NULL);
+    if (!json) {
+        SDL_Log("Could not read baseline %s: %s\n", path, SDL_GetError());
+        return false;
+    }
+
+    int slower = 0, matched = 0;
+    for(int i = 0; i < nr; i++) {
+        const char *p = json, *name;
+        double base = -1.0;
+        while((name = micro_field(p, "name"))) {
+            const char *n = micro_field(name, "n");
+            const char *median = micro_field(name, "median_ns");
+            if (!n || !median) break;
+            p = median;
+            size_t len = SDL_strlen(res[i].name);
+            if (SDL_strncmp(name + 1, res[i].name, len) == 0 && name[len + 1] == '"' &&
+                    SDL_atoi(n) == res[i].n) {
+                base = SDL_strtod(median, NULL);
+                break;
+            }
+        }
+        if (base <= 0.0) {
+            SDL_Log("compare: %-18s %6d  %9s -> %9.2f ns  new\n", res[i].name, res[i].n,
+                    "-", res[i].median);
+            continue;
+        }
+        double pct = (res[i].median - base) * 100.0 / base;
+        bool bad = pct > threshold;
+        SDL_Log("compare: %-18s %6d  %9.2f -> %9.2f ns  %+6.1f%%%s\n", res[i].name,
+                res[i].n, base, res[i].median, pct, bad ? "  SLOWER" : "");
+        slower += bad;
+        matched++;
+    }
+    SDL_Log("compare: %d of %d cases in %s, %d slower by more than %.0f%%\n",
+            matched, nr, path, slower, threshold);
+    SDL_free(json);
+    return slower == 0;
+}
+
+bool
+micro_write(const char *path, const MicroResult *res, int nr)
+{
+    SDL_IOStream *io = SDL_IOFromFile(path, "w");
+    if (!io) {
+        SDL_Log("Could not write %s: %s\n", path, SDL_GetError());
+        return false;
+    }
+    SDL_IOprintf(io, "{\n  \"build\": \"%s\",\n  \"samples\": %d,\n  \"results\": [\n",
+            BUILD_ID, MICRO_SAMPLES);
+    for(int i = 0; i < nr; i++) {
+        SDL_IOprintf(io, "    {\"name\": \"%s\", \"n\": %d, \"reps\": %d, \"median_ns\": %.3f, "
+                "\"min_ns\": %.3f, \"max_ns\": %.3f}%s\n", res[i].name, res[i].n, res[i].reps,
+                res[i].median, res[i].min, res[i].max, i + 1 < nr ? "," : "");
+    }
+    SDL_IOprintf(io, "  ]\n}\n");
+    SDL_CloseIO(io);
+    SDL_Log("micro: wrote %s\n", path);
+    return true;
+}
+
+/* The `make bench` harness: every case at every count on one thread,
+ * written to out as JSON and, given a baseline, compared against it. */
+bool
+microbench(const char *out, const char *baseline, double threshold)
+{
+    static const int counts[] = {100, 1000, 10000};
+    enum { CASES = SDL_arraysize(micro_cases) };
+    MicroResult res[CASES * SDL_arraysize(counts)];
+    int nr = 0;
+
+    int cores = jobs.threads;
+    jobs_shutdown();
+    jobs_init(1);
+    for(size_t c = 0; c < SDL_arraysize(counts); c++) {
+        MicroState s;
+        micro_setup(&s, counts[c]);
+        for(int k = 0; k < CASES; k++) {
+            MicroResult *r = &res[nr++];
+            *r = micro_run(&micro_cases[k], &s);
+            SDL_Log("micro: %-18s %6d  %9.2f ns  (min %.2f max %.2f, %d reps)\n",
+                    r->name, r->n, r->median, r->min, r->max, r->reps);
+        }
+        micro_teardown(&s);
+    }
+    jobs_shutdown();
+    jobs_init(cores);
+
+    /* Compare first; out may be the baseline itself. */
+    bool ok = !baseline || micro_compare(baseline, res, nr, threshold);
+    return micro_write(out, res, nr) && ok;
+}
+
+Options
+parse_args(int argc, char **argv)
+{
+    Options opt = {.hz = SIM_HZ, .gpu_particles = true, .stress.mix = {1, 1, 1},
+        .threshold = MICRO_REGRESSION, .fps = PRESENT_FPS};
+    for(int i = 1; i < argc; i++) {
+        if (SDL_strcmp(argv[i], "--headless") == 0) {
+            opt.headless = true;
+        } else if (SDL_strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            opt.frames = SDL_strtoull(argv[++i], NULL, 10);
+        } else if (SDL_strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            opt.profile = argv[++i];
+        } else if (SDL_strcmp(argv[i], "--hz") == 0 && i + 1 < argc) {
+            opt.hz = SDL_atoi(argv[++i]);
+        } else if (SDL_strcmp(argv[i], "--bench") == 0) {
+            opt.bench = true;
+        } else if (SDL_strcmp(argv[i], "--microbench") == 0 && i + 1 < argc) {
+            opt.microbench = argv[++i];
+        } else if (SDL_strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            opt.baseline = argv[++i];
+        } else if (SDL_strcmp(argv[i], "--present") == 0 && i + 1 < argc) {
+            i++;
+            opt.present = PRESENT_COUNT;
+            for(int k = 0; k < PRESENT_COUNT; k++) {
+                if (SDL_strcmp(argv[i], present_names[k]) == 0) opt.present = k;
+            }
+            if (opt.present == PRESENT_COUNT) {
+                ERROR_EXIT(1, "--present takes vsync, adaptive, immediate or capped\n");
+            }
+            opt.present_set = true;
+        } else if (SDL_strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            opt.fps = SDL_atoi(argv[++i]);
+        } else if (SDL_strcmp(argv[i], "--finish") == 0) {
+            opt.finish = true;
+        } else if (SDL_strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            opt.threshold = SDL_strtod(argv[++i], NULL);
+        } else if (SDL_strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            opt.seed = SDL_strtoull(argv[++i], NULL, 10);
+            opt.seeded = true;
+        } else if (SDL_strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            opt.record = argv[++i];
+        } else if (SDL_strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            opt.replay = argv[++i];
+        } else if (SDL_strcmp(argv[i], "--uncapped") == 0) {
+            opt.uncapped = true;
+        } else if (SDL_strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            opt.threads = SDL_atoi(argv[++i]);
+        } else if (SDL_strcmp(argv[i], "--particles") == 0 && i + 1 < argc &&
+                (SDL_strcmp(argv[i + 1], "cpu") == 0 || SDL_strcmp(argv[i + 1], "gpu") == 0)) {
+            opt.gpu_particles = SDL_strcmp(argv[++i], "gpu") == 0;
+            opt.particles_set = true;
+        } else if (SDL_strcmp(argv[i], "--stress") == 0 && i + 1 < argc) {
+            opt.stress.asteroids = SDL_atoi(argv[++i]);
+            opt.stress.on = true;
+        } else if (SDL_strcmp(argv[i], "--mix") == 0 && i + 1 < argc) {
+            char *end = argv[++i];
+            for(int k = 0; k < 3; k++) {
+                opt.stress.mix[k] = (int)SDL_strtol(end + (k > 0), &end, 10);
+                if (*end != (k < 2 ? ':' : '\0') || opt.stress.mix[k] < 0) {
+                    ERROR_EXIT(1, "--mix takes BIG:MEDIUM:SMALL weights, like 1:2:4\n");
+                }
+            }
+        } else if (SDL_strcmp(argv[i], "--bullets") == 0 && i + 1 < argc) {
+            opt.stress.bullets = SDL_atoi(argv[++i]);
+            opt.stress.on = true;
+        } else if (SDL_strcmp(argv[i], "--cascade") == 0 && i + 1 < argc) {
+            opt.stress.cascade = SDL_strtoull(argv[++i], NULL, 10);
+            opt.stress.on = true;
+        } else {
+            ERROR_EXIT(1, "usage: %s [--headless] [--uncapped] [--frames N] [--profile out.csv] "
+                    "[--hz %d-%d] [--seed N] [--threads N] [--record in.rec | --replay in.rec] "
+                    "[--particles cpu|gpu] [--present vsync|adaptive|immediate|capped] [--fps N] "
+                    "[--finish] [--stress N] [--mix B:M:S] [--bullets N] "
+                    "[--cascade TICK] [--bench] [--microbench out.json [--baseline in.json] [--threshold PCT]]\n",
+                    argv[0], SIM_MIN_HZ, SIM_MAX_HZ);
+        }
+    }
+    if (opt.hz < SIM_MIN_HZ || opt.hz > SIM_MAX_HZ) {
+        ERROR_EXIT(1, "--hz must be between %d and %d\n", SIM_MIN_HZ, SIM_MAX_HZ);
+    }
+    if (opt.record && opt.replay) {
+        ERROR_EXIT(1, "--record and --replay are exclusive\n");
+    }
+    if (opt.baseline && !opt.microbench) {
+        ERROR_EXIT(1, "--baseline only applies to --microbench\n");
+    }
+    if (opt.stress.on && (opt.record || opt.replay)) {
+        ERROR_EXIT(1, "stress runs cannot be recorded or replayed\n");
+    }
+    if (opt.stress.mix[BIG] + opt.stress.mix[MEDIUM] + opt.stress.mix[SMALL] == 0) {
+        ERROR_EXIT(1, "--mix needs at least one non-zero weight\n");
+    }
+    if (opt.stress.asteroids < 0 || opt.stress.bullets < 0) {
+        ERROR_EXIT(1, "--stress and --bullets take a count\n");
+    }
+    /* Most pieces the field can split into: a cascade triples a BIG, and
+     * bullets first can turn it into three MEDIUMs that cascade to six. */
+    if (opt.stress.cascade || opt.stress.bullets) {
+        Uint64 each = opt.stress.mix[BIG] ? (opt.stress.bullets ? 6 : 3) :
+            opt.stress.mix[MEDIUM] ? 2 : 1;
+        if ((Uint64)opt.stress.asteroids * each > AST_SLOT_MASK + 1) {
+            ERROR_EXIT(1, "--stress %d can split into %llu asteroids, over the limit of %u\n",
+                    opt.stress.asteroids, (unsigned long long)opt.stress.asteroids * each,
+                    AST_SLOT_MASK + 1);
+        }
+    }
+    if ((Uint64)opt.stress.asteroids > AST_SLOT_MASK + 1) {
+        ERROR_EXIT(1, "--stress takes at most %u asteroids\n", AST_SLOT_MASK + 1);
+    }
+    if (opt.stress.on && opt.headless && !opt.frames) opt.frames = 10 * opt.hz;
+    if (opt.fps < 1) {
+        ERROR_EXIT(1, "--fps must be at least 1\n");
+    }
+    if (opt.headless) {
+        opt.uncapped = true;
+        if (!opt.particles_set) opt.gpu_particles = false;
+    }
+    if (!opt.present_set) opt.present = opt.uncapped ? PRESENT_IMMEDIATE : PRESENT_VSYNC;
+    return opt;
+}
+
+int
+main(int argc, char **argv)
+{
+    Options opt = parse_args(argc, argv);
+    headless = opt.headless;
+    kernels_init();
+    jobs_init(opt.threads);
+    SDL_Log("jobs: %d threads\n", jobs.threads);
+    if (opt.bench) {
+        headless = true;
+        shape_cache_init(&shapes, 64);
+        bool ok = kernels_check();
+        bench_kernels();
+        bench_asteroids();
+        ok = bench_broadphase() && ok;
+        bench_narrowphase();
+        ok = asteroids_check() && ok;
+        ok = bullets_check() && ok;
+        ok = sim_check() && ok;
+        ok = replay_check() && ok;
+        ok = bench_jobs() && ok;
+        bench_particles();
+        if (opt.particles_set && opt.gpu_particles) {
+            SDL_Window *window = init_window(R_WIDTH, R_HEIGHT, SDL_WINDOW_HIDDEN);
+            pipelines_init();
+            ok = gpu_particles_check() && ok;
+            pipelines_destroy();
+            SDL_GL_DestroyContext(con);
+            SDL_DestroyWindow(window);
+        }
+        jobs_shutdown();
+        return ok ? 0 : 1;
+    }
+    if (opt.microbench) {
+        headless = true;
+        shape_cache_init(&shapes, 64);
+        bool ok = microbench(opt.microbench, opt.baseline, opt.threshold);
+        jobs_shutdown();
+        return ok ? 0 : 1;
+    }
+
+    SDL_Window *window = NULL;
+    if (headless) {
+        if (!SDL_Init(SDL_INIT_EVENTS)) {
+            ERROR_EXIT(1, "SDL initialization failed: %s\n", SDL_GetError());
+        }
+        SDL_Log("Headless: null renderer, no vsync\n");
+        /* Transform feedback still needs a context; the window never shows. */
+        if (opt.gpu_particles) window = init_window(R_WIDTH, R_HEIGHT, SDL_WINDOW_HIDDEN);
+    } else {
+        window = init_window(1280, 720, 0);
+    }
+    Present present = {.fps = opt.fps};
+    present_set(&present, opt.present, opt.finish);
+    SDL_Log("present: %s%s\n", present_names[present.mode], present.finish ? " + finish" : "");
+    uint8_t running = 1;
+
+    float vertices[] = {
+        -0.4f, -0.5f, 0.0f,
+        -0.2f, -0.4f, 0.0f,
+         0.2f, -0.4f, 0.0f,
+         0.4f, -0.5f, 0.0f,
          0.0f,  0.5,  0.0f,
         -0.4f, -0.5f, 0.0f,
         -0.2f, -0.4f, 0.0f,
@@ -463,251 +4586,258 @@ main(int argc, char **argv)
          0.2f, -0.4f, 0.0f
     };
 
-    glViewport(0, 0, R_WIDTH, R_HEIGHT);
-
-    unsigned int vao, vbo;
-    vao_init(&vao, &vbo, vertices, sizeof(vertices));
-
-    Asteroid asteroid[MAX_ASTEROIDS * 2];
-
-    const char *vertexShaderSource = 
-        "#version 330 core\n"
-        "layout (location = 0) in vec3 aPos;\n"
-        "uniform mat4 transform;\n"
-        "void main()\n"
-        "{\n"
-        "   gl_Position = transform * vec4(aPos.xyz, 1.0);\n"
-        "}\0";
-
-    unsigned int vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, &vertexShaderSource, 0);
-    glCompileShader(vertex_shader);
-    check_shader_err(vertex_shader, GL_COMPILE_STATUS, "VERTEX");
-
-    const char *fragmentShaderSource  = 
-        "#version 330 core\n"
-        "out vec4 FragColor;\n"
-        //"uniform float t;\n"
-        "void main() { \n"
-        //"    vec3 color = 0.9 + 0.5 * (cos(t * vec3(0.5, 0.2, 0.3)));\n"
-        "    FragColor = vec4(1.0, 1.0, 1.0, 1.0f);\n"
-        "}\0"; 
-
-    unsigned int fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, &fragmentShaderSource, 0);
-    glCompileShader(fragment_shader);
-    check_shader_err(fragment_shader, GL_COMPILE_STATUS, "FRAGMENT");
-
-    shader = glCreateProgram();
-    glAttachShader(shader, vertex_shader);
-    glAttachShader(shader, fragment_shader);
-    glLinkProgram(shader);
-    check_shader_err(shader, GL_LINK_STATUS, "PROGRAM");
-
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
+    if (!headless) glViewport(0, 0, R_WIDTH, R_HEIGHT);
+
+    pipelines_init();
 
     Uint64 freq = SDL_GetPerformanceFrequency();
     Uint64 counter1 = SDL_GetPerformanceCounter(), counter2;
-    float delta_time = 0.0f;
 
     mat4x4_ortho(projection,  0.0f, R_WIDTH, R_HEIGHT, 0.0f, 
             -1.0f, 1.0f); 
 
+    for(int i = 0; i < PIPE_COUNT && !headless; i++) {
+        Shader *sh = &pipelines[i];
+        gl_use_program(sh->program);
+        glUniformMatrix4fv(sh->uniform[U_PROJECTION], 1, GL_FALSE, (GLfloat *)projection);
+        glUniform1i(sh->uniform[U_SHAPES], 0);
+        glUniform1i(sh->uniform[U_STRIDE], SHAPE_STRIDE);
+        glUniform2f(sh->uniform[U_WORLD], R_WIDTH, R_HEIGHT);
+    }
+
     Uint8 frame = 0;
-    size_t ast_size = MAX_ASTEROIDS;
 
-    for(size_t i = 0; i < ast_size; i++){
-        asteroid[i].as = SDL_rand(3);
-        get_rand_ast(&asteroid[i]);
-        asteroid[i].time = 0;
-    }
-    
-    bool dead = false;
-    Uint32 dtime = 0;
-    Bullet b = {.size = 0};
+    shape_cache_init(&shapes, MAX_ASTEROIDS * 2 + 2);
+    int ship_shape = shape_store(&shapes, vertices, 6, false);
+    int thrust_shape = shape_store(&shapes, vertices, 9, false);
 
-    glad_glPointSize(3); 
-    Renderer r = renderer_init(0);
-    Renderer r2 = renderer_init(0);
-    Renderer r3 = renderer_init(0);
+    static Game game;
+    Game *g = &game;
+    InputLog rec = {0};
+    if (opt.replay) {
+        input_log_open(&rec, opt.replay);
+        game_init(g, rec.hz, rec.seed);
+    } else {
+        game_init(g, opt.hz, opt.seeded ? opt.seed : SDL_GetPerformanceCounter());
+    }
+    if (opt.record) input_log_create(&rec, opt.record, g);
+    if (opt.stress.on) {
+        game_stress(g, &opt.stress);
+        SDL_Log("stress: %d asteroids (mix %d:%d:%d), %d bullets, cascade at tick %llu\n",
+                g->ast.size, opt.stress.mix[BIG], opt.stress.mix[MEDIUM],
+                opt.stress.mix[SMALL], opt.stress.bullets,
+                (unsigned long long)opt.stress.cascade);
+    }
+    GpuParticles gpu_fx = {0};
+    if (opt.gpu_particles) {
+        gpu_particles_init(&gpu_fx, PARTICLE_CAP);
+        g->fx.deferred = true;
+    }
+    SDL_Log("particles: %s\n", opt.gpu_particles ? "gpu transform feedback" : "cpu");
+    Input in = {0};
+    double acc = 0.0;
 
-    Uint32 tick1 = SDL_GetTicks();
+    if (!headless) gl_point_size(3); 
+    stream_init(&stream, STREAM_REGION);
+    prof_init(&prof);
+    Instances inst = instances_init(pipeline_find("outlines"), 4);
+    Instances hud = instances_init(pipeline_find("outlines"), 1);
+    Batch points = batch_init(GL_POINTS, pipeline_find("points"));
+    lines = batch_init(GL_LINES, pipeline_find("lines"));
 
-    Player p;
-    p.pos.x = R_WIDTH / 2;
-    p.pos.y = R_HEIGHT / 2;
-    p.size.x = PSIZE;
-    p.size.y = PSIZE;
-    p.life = 3;
-    p.angle = 0.0f;
-    p.vel.x = .0f;
-    p.vel.y = .0f;
-    p.dir = get_direction(p.angle);
-
-    Vector2 pos_p[6];
-    bool act_p = false;
-    Uint32 p_tm = 0;
-    Vector2 dir_p[6];
-
-    float angle = 0.0f;
+    bool overlay = false;
+    bool graph = false;
+    Uint64 start = SDL_GetPerformanceCounter();
    
     while(running) {
-        int nr_v = 6;
         SDL_Event ev;
+        prof_begin_frame(&prof);
+        prof_begin(&prof, P_EVENTS);
         while(SDL_PollEvent(&ev)) {
             switch (ev.type) {
                 case SDL_EVENT_QUIT :
                     running = 0;
                     break;
                 case SDL_EVENT_KEY_UP:
-                    if(ev.key.scancode == SDL_SCANCODE_J && !dead) {
-                        Vector2 t = vector2_add(p.pos, vector2_scale(&p.dir, PSIZE / 2.0f));
-                        b_append_pos(&b, &t, &p.dir, tick1);
+                    if(ev.key.scancode == SDL_SCANCODE_J) {
+                        in.fire++;
+                    }
+                    if(ev.key.scancode == SDL_SCANCODE_F3) {
+                        overlay = !overlay;
+                    }
+                    if(ev.key.scancode == SDL_SCANCODE_F4) {
+                        graph = !graph;
+                    }
+                    if(ev.key.scancode == SDL_SCANCODE_F5) {
+                        present_set(&present, (present.mode + 1) % PRESENT_COUNT, present.finish);
+                        SDL_Log("present: %s\n", present_names[present.mode]);
+                    }
+                    if(ev.key.scancode == SDL_SCANCODE_F6) {
+                        present_set(&present, present.mode, !present.finish);
+                        SDL_Log("present: finish %s\n", present.finish ? "on" : "off");
                     }
                     break;
             }
         }
-
-        glClearColor(0.0f, .0f, .0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
         const bool *keyboard = SDL_GetKeyboardState(NULL);
-        if(keyboard[SDL_SCANCODE_W] && !dead) {
-            p.vel = vector2_add(p.vel,
-                    vector2_scale(&p.dir, delta_time * PLAYER_SPEED));
-            if(frame % 3 == 0)
-                nr_v = 9;
-        }
-
-        if(keyboard[SDL_SCANCODE_Q] && !dead) {
-            p.angle -= delta_time * (PI * 2.0f) * 1.5f;
-            p.dir = get_direction(p.angle);
-
-        } else if (keyboard[SDL_SCANCODE_E] && !dead) {
-            p.angle += delta_time * (PI * 2.0f) * 1.5f;
-            p.dir = get_direction(p.angle);
-        }
-
-        if(!dead) {
-            p.vel = vector2_scale(&p.vel, 1.0f - DRAG);
-            p.pos = vector2_add(p.pos, p.vel);
-
-            Vector2 tmp_player = drw_t(&p.pos, &p.size);
-
-            if(tmp_player.x > -100 && tmp_player.y > -100) {
-                draw(GL_LINE_STRIP, &tmp_player, &p.size, p.angle, vao, nr_v);
-            }
+        in.thrust = keyboard[SDL_SCANCODE_W];
+        in.left = keyboard[SDL_SCANCODE_Q];
+        in.right = keyboard[SDL_SCANCODE_E];
+        prof_end(&prof, P_EVENTS);
 
-            p.pos = vector2_modf(p.pos, R_WIDTH, R_HEIGHT);
-        }
-        for(size_t i = 0; i < ast_size; i++) {
-            if(asteroid[i].time > tick1) {
-                int ind_p = 0;
-                float vert_p[6 * 3];
-                if(!act_p){
-                    p_tm = SDL_GetTicks() + 1300;
-                    for(int k = 0; k < 6; k++) {
-                        pos_p[k] = asteroid[i].pos;
-                        dir_p[k].x = SDL_randf() + 0.1;
-                        dir_p[k].y = SDL_randf() + 0.1;
-                    }
-                    act_p = true;
-                }
-
-                for(int j = 0; j < 6; j++) {
-                    pos_p[j] = vector2_add(pos_p[j], vector2_scale(&dir_p[j], PLAYER_SPEED * delta_time));
-                    vert_p[ind_p++] = pos_p[j].x; 
-                    vert_p[ind_p++] = pos_p[j].y;
-                    vert_p[ind_p++] = 0.0f; 
-                }
-                update_renderer(&r3, vert_p, 6 * 3 * sizeof(vert_p));
-                draw(GL_POINTS, &(Vector2){0, 0}, &(Vector2){1,1}, 0.0f, r3.vao, ind_p/3);
-                continue;
-            }
-            
-            if(asteroid[i].as == DEAD) {
-                asteroid[i] = asteroid[ast_size - 1];
-                ast_size--;
-                i--;
-            }
+        /* Uncapped frames run back to back at exactly one tick each. The
+         * cap drops time after a long stall instead of trying to catch up. */
+        counter2 = SDL_GetPerformanceCounter();
+        acc += opt.uncapped ? g->dt : (double)(counter2 - counter1) / (double)freq;
+        counter1 = counter2;
+        if (acc > SIM_MAX_LAG) acc = SIM_MAX_LAG;
 
-            Vector2 dir = get_direction(asteroid[i].angle);
-            asteroid[i].pos = vector2_add(asteroid[i].pos, vector2_scale(&dir, delta_time * asteroid[i].vel));
+        if (!game_advance(g, &in, &acc, &rec)) running = 0;
+        float alpha = (float)(acc / g->dt);
 
-            Vector2 tmp_ast = drw_t(&asteroid[i].pos, &asteroid[i].size);
-            if(tmp_ast.x > -100 && tmp_ast.y > -100) {
-                Asteroid ast_ = asteroid[i];
-                ast_.pos = tmp_ast;
-                draw_asteroid(&ast_, &r);
-            }
-            if(collision(&p.pos, &asteroid[i].pos, &asteroid[i].size) && !dead) {
-                dead = true;
-                dtime = SDL_GetTicks() + 1300;
-                angle = 0.0f;
-            }
-            asteroid[i].pos = vector2_modf(asteroid[i].pos, R_WIDTH, R_HEIGHT);
-            draw_asteroid(&asteroid[i], &r);
-        }
-        if(p_tm < tick1) {
-            act_p = false;
-        }
-        //shoot(&b, &r2);
-        float vert[b.size * 3];
-        int ind = 0;
-        for(int i = 0; i < b.size; i++) {
-            if(tick1 > (b.time[i] + 1300) || ast_collision(&b.pos[i], asteroid, &ast_size)) {
-                //b.time[i] = tick1;
-                b.pos[i] = b.pos[b.size - 1]; 
-                b.dir[i] = b.dir[b.size - 1]; 
-
-                b.size--;
-                i--;
-                continue;
-            }
+        gl_begin_frame();
+        stream_begin_frame(&stream);
+        prof_gpu_begin(&prof);
+        if (!headless) {
+            glClearColor(0.0f, .0f, .0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
 
-            b.pos[i] = vector2_add(b.pos[i], vector2_scale(&b.dir[i], delta_time * PLAYER_SPEED * 28.0f));
-            b.pos[i] = vector2_modf(b.pos[i], R_WIDTH, R_HEIGHT);
-        
-            vert[ind++] = b.pos[i].x;
-            vert[ind++] = b.pos[i].y;
-            vert[ind++] = 0.0f;
+        prof_begin(&prof, P_RENDER);
+        Player *p = &g->p;
+        draw_asteroids(&g->ast, g->time, alpha, &inst);
+        if (opt.gpu_particles) {
+            gpu_particles_update(&gpu_fx, &g->fx, g->dt, g->time);
+            gpu_particles_draw(&gpu_fx, g->time, g->dt, alpha);
+        } else {
+            particles_draw(&g->fx, alpha, &points);
+        }
+        Bullets *b = &g->b;
+        for(int i = b->head; i < b->head + b->size; i++) {
+            batch_point(&points, vector2_lerp_wrap((Vector2){b->px[i], b->py[i]},
+                        (Vector2){b->x[i], b->y[i]}, alpha));
         }
-        update_renderer(&r2, vert, b.size * 3 * sizeof(float));
-        draw(GL_POINTS, &(Vector2){0, 0}, &(Vector2){1, 1}, 0.0f, r2.vao, ind / 3);
 
-        for(int i = 0; i < p.life; i++) {
-            draw(GL_LINE_STRIP, &(Vector2){PSIZE * i + 20, 40}, &p.size, PI, vao, 6);
+        for(int i = 0; i < p->life; i++) {
+            instance_push(&hud, &(Vector2){PSIZE * i + 20, 40}, &p->size, PI, ship_shape);
         }
 
-        if(dead && dtime > tick1) {
-            p.vel.y = 0;
-            p.vel.x = 0;
-            angle += (PI/2) * delta_time;
-            draw_line_a(p.pos.x, p.pos.y, p.pos.x + 10, p.pos.y + 10, angle);
-            draw_line_a(p.pos.x - 10, p.pos.y, p.pos.x, p.pos.y + 10, -angle);
-            draw_line_a(p.pos.x - 5, p.pos.y + 10, p.pos.x + 5, p.pos.y + 10, angle/2);
+        if(g->dead) {
+            float angle = g->angle;
+            line_a(p->pos.x, p->pos.y, p->pos.x + 10, p->pos.y + 10, angle);
+            line_a(p->pos.x - 10, p->pos.y, p->pos.x, p->pos.y + 10, -angle);
+            line_a(p->pos.x - 5, p->pos.y + 10, p->pos.x + 5, p->pos.y + 10, angle/2);
         } else {
-            if(dead) p.life--;
-            angle = 0.0f;
-            dead = false;
-            draw(GL_LINE_STRIP, &p.pos, &p.size, p.angle, vao, nr_v);
+            Vector2 pos = vector2_lerp_wrap(g->prev_pos, p->pos, alpha);
+            float angle = g->prev_angle + (p->angle - g->prev_angle) * alpha;
+            instance_push(&inst, &pos, &p->size, angle,
+                    g->thrust && frame % 3 == 0 ? thrust_shape : ship_shape);
         }
 
-        if(p.life < 1) running = 0;
-        SDL_GL_SwapWindow(window);
-        counter2 = SDL_GetPerformanceCounter();
-        delta_time = (float)(counter2 - counter1) / (float)freq;
+        if (overlay) {
+            char buf[64];
+            SDL_snprintf(buf, sizeof(buf), "GL %u ELIDED %u DRAWS %u",
+                    gl.last_issued, gl.last_elided, gl.last_draws);
+            text(R_WIDTH - 360, 20, 2.0f, buf);
+            SDL_snprintf(buf, sizeof(buf), "STREAM %u B STALLS %u",
+                    stream.last_bytes, stream.stalls);
+            text(R_WIDTH - 360, 40, 2.0f, buf);
+            SDL_snprintf(buf, sizeof(buf), "VERTS %u", gl.last_vertices);
+            text(R_WIDTH - 360, 60, 2.0f, buf);
+            SDL_snprintf(buf, sizeof(buf), "SIM %d HZ TICK %llu", g->hz,
+                    (unsigned long long)g->ticks);
+            text(R_WIDTH - 360, 80, 2.0f, buf);
+            SDL_snprintf(buf, sizeof(buf), "AST %d BUL %d", g->ast.size, g->b.size);
+            text(R_WIDTH - 360, 100, 2.0f, buf);
+            SDL_snprintf(buf, sizeof(buf), "%s%s %.2f MS SD %.2f", present_names[present.mode],
+                    present.finish ? " FINISH" : "", present.mean,
+                    present.frames > 1 ? SDL_sqrt(present.m2 / (present.frames - 1)) : 0.0);
+            text(R_WIDTH - 360, 120, 2.0f, buf);
+        }
+        if (graph) prof_draw(&prof, 20, R_HEIGHT - 420);
+
+        instances_flush(&inst);
+        instances_flush(&hud);
+        batch_flush(&lines);
+        batch_flush(&points);
+        prof_gpu_end(&prof);
+        stream_end_frame(&stream);
+        prof_end(&prof, P_RENDER);
+
+        if(p->life < 1) running = 0;
+        if(opt.frames && stream.frames >= opt.frames) running = 0;
+        prof_begin(&prof, P_SWAP);
+        if(!headless) SDL_GL_SwapWindow(window);
+        present_frame(&present);
+        prof_end(&prof, P_SWAP);
+        prof_end_frame(&prof);
         frame++;
-        tick1 = SDL_GetTicks();
         //glUseProgram(shader);
         //glUniform1f(glGetUniformLocation(shader, "t"), ((float)tick1 / 1000));
-        counter1 = counter2;
     }
     
-    glDeleteProgram(shader);
-    SDL_GL_DestroyContext(con);
-    SDL_DestroyWindow(window);
+    SDL_Log("bullets: %llu fired, %llu hit, %llu expired, %llu dropped\n",
+            (unsigned long long)g->b.fired, (unsigned long long)g->b.hits,
+            (unsigned long long)g->b.expired, (unsigned long long)g->b.dropped);
+    if (opt.gpu_particles) {
+        SDL_Log("particles: %llu spawned, %llu steps of %.1f records, %llu bytes uploaded\n",
+                (unsigned long long)g->fx.spawned, (unsigned long long)gpu_fx.steps,
+                gpu_fx.steps ? (double)gpu_fx.stepped / gpu_fx.steps : 0.0,
+                (unsigned long long)gpu_fx.bytes);
+        gpu_particles_destroy(&gpu_fx);
+    } else {
+        SDL_Log("particles: %d live, %llu dropped\n", g->fx.size,
+                (unsigned long long)g->fx.dropped);
+    }
+    if (opt.record || opt.replay) {
+        SDL_Log("sim: seed %llu, %llu ticks, checksum %016llx\n",
+                (unsigned long long)g->seed, (unsigned long long)g->ticks,
+                (unsigned long long)g->checksum);
+    } else {
+        SDL_Log("sim: seed %llu, %llu ticks\n",
+                (unsigned long long)g->seed, (unsigned long long)g->ticks);
+    }
+    if (opt.stress.on) {
+        SDL_Log("stress: %d asteroids, %d bullets at exit; per-frame scopes over the last %d frames\n",
+                g->ast.size, g->b.size, PROF_FRAMES);
+        prof_report(&prof);
+    }
+    bool replay_ok = true;
+    if (opt.replay) {
+        double secs = (double)(SDL_GetPerformanceCounter() - start) / (double)freq;
+        replay_ok = g->ticks == rec.ticks && g->checksum == rec.checksum;
+        SDL_Log("replay: %llu of %llu ticks in %.3f s, %.0f ticks/s, %s\n",
+                (unsigned long long)g->ticks, (unsigned long long)rec.ticks, secs,
+                g->ticks / secs, replay_ok ? "checksum matches" : "CHECKSUM MISMATCH");
+    }
+    if (rec.io) input_log_close(&rec, g);
+    game_destroy(g);
+    if (opt.profile) prof_write_csv(&prof, opt.profile);
+    prof_destroy(&prof);
+    pipelines_destroy();
+    gl_begin_frame(); /* folds the last frame into the totals */
+
+    double elapsed = (double)(SDL_GetPerformanceCounter() - start) / (double)freq;
+    if (gl.frames > 1) {
+        Uint64 n = gl.frames - 1;
+        SDL_Log("frames: %llu in %.3f s, %.1f fps, %.1f draws/frame, %.1f vertices/frame\n",
+                (unsigned long long)n, elapsed, n / elapsed,
+                (double)gl.total_draws / n, (double)gl.total_vertices / n);
+    }
+
+    if (stream.frames) {
+        SDL_Log("stream: %llu frames, %.1f bytes/frame, %llu stalls, %llu failed maps\n",
+                (unsigned long long)stream.frames,
+                (double)stream.total_bytes / stream.frames,
+                (unsigned long long)stream.total_stalls,
+                (unsigned long long)stream.total_map_fails);
+    }
+    present_report(&present);
+    if (window) {
+        SDL_GL_DestroyContext(con);
+        SDL_DestroyWindow(window);
+    }
+    jobs_shutdown();
     SDL_Quit();
-    return 0;
+    return replay_ok ? 0 : 1;
 }